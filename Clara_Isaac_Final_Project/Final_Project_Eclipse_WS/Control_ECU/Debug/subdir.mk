@@ -4,37 +4,58 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../audit.c \
 ../buzzer.c \
 ../control_ecu.c \
+../crc.c \
 ../dc_motor.c \
 ../external_eeprom.c \
 ../gpio.c \
+../internal_eeprom.c \
+../link.c \
 ../pwm_timer0.c \
+../store.c \
+../tick.c \
 ../timer1.c \
 ../twi.c \
-../uart.c 
+../uart.c \
+../users.c 
 
 OBJS += \
+./audit.o \
 ./buzzer.o \
 ./control_ecu.o \
+./crc.o \
 ./dc_motor.o \
 ./external_eeprom.o \
 ./gpio.o \
+./internal_eeprom.o \
+./link.o \
 ./pwm_timer0.o \
+./store.o \
+./tick.o \
 ./timer1.o \
 ./twi.o \
-./uart.o 
+./uart.o \
+./users.o 
 
 C_DEPS += \
+./audit.d \
 ./buzzer.d \
 ./control_ecu.d \
+./crc.d \
 ./dc_motor.d \
 ./external_eeprom.d \
 ./gpio.d \
+./internal_eeprom.d \
+./link.d \
 ./pwm_timer0.d \
+./store.d \
+./tick.d \
 ./timer1.d \
 ./twi.d \
-./uart.d 
+./uart.d \
+./users.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
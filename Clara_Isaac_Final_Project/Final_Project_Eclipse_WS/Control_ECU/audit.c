@@ -0,0 +1,289 @@
+ /******************************************************************************
+ *
+ * Module: Audit
+ *
+ * File Name: audit.c
+ *
+ * Description: Source file for the access audit log in the external EEPROM
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "audit.h"
+#include "crc.h"
+#include "tick.h"
+#include <string.h> /* To use memcpy and memset functions */
+
+#if ((AUDIT_FIRST_PAGE + AUDIT_PAGES_NUM) > (EEPROM_SIZE / EEPROM_PAGE_SIZE)) || (AUDIT_PAGES_NUM < 2)
+#error "The audit ring needs at least 2 pages inside the EEPROM"
+#endif
+
+#define AUDIT_CRC_OFFSET AUDIT_PAGE_DATA_SIZE
+
+/* Pages read by one sequential read at boot */
+#define AUDIT_INIT_BATCH_PAGES 4
+
+/* EEPROM address of a page of the ring */
+#define AUDIT_PAGE_ADDRESS(page) ((uint32)(AUDIT_FIRST_PAGE + (page)) * EEPROM_PAGE_SIZE)
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Head index: page and sequence number of the newest page */
+static boolean g_hasPage = FALSE;
+static uint8 g_headPage = 0;
+static uint16 g_headSeq = 0;
+static uint8 g_boot = 0;
+
+/* Events waiting for their page write */
+static uint8 g_buffer[AUDIT_BUFFER_RECORDS * AUDIT_RECORD_SIZE];
+static uint8 g_buffered = 0;
+static uint32 g_firstBufferedTime = 0;
+
+/* Page being written in the background, it must not change before the write is sent */
+static uint8 g_page[EEPROM_PAGE_SIZE];
+static EEPROM_Request g_request;
+
+/* Buffered events copied into the page being written, they leave the buffer once it is stored */
+static boolean g_writing = FALSE;
+static uint8 g_pageRecords = 0;
+static boolean g_writeFailed = FALSE;
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Return the inverted CRC-8 of a page, as stored in its last byte.
+ */
+static uint8 AUDIT_pageCrc(const uint8 *page);
+
+/*
+ * Description:
+ * Read a page of the ring, return TRUE if it is valid.
+ */
+static boolean AUDIT_readValidPage(uint8 page, uint8 *data);
+
+/*
+ * Description:
+ * Copy up to one page of buffered events into the next page of the ring and start its write.
+ * Return EEPROM_PENDING if a page write is still in progress.
+ */
+static uint8 AUDIT_writePage(void);
+
+/*
+ * Description:
+ * Check the page write once it is done, the ring head moves and its events leave the buffer
+ * only if it succeeded, otherwise the same page is written again later.
+ */
+static void AUDIT_endWrite(void);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Find the newest page of the ring, the boot number of this run is the next one.
+ */
+void AUDIT_init(void)
+{
+	uint8 page, index, count, data[AUDIT_INIT_BATCH_PAGES * EEPROM_PAGE_SIZE], *current;
+	uint16 seq;
+
+	g_hasPage = FALSE;
+	for(page = 0; page < AUDIT_PAGES_NUM; page += count)
+	{
+		count = ((AUDIT_PAGES_NUM - page) < AUDIT_INIT_BATCH_PAGES) ? (AUDIT_PAGES_NUM - page) : AUDIT_INIT_BATCH_PAGES;
+		/* The pages of the ring are contiguous, a batch is one addressing phase and one read burst */
+		if(EEPROM_readBlock(AUDIT_PAGE_ADDRESS(page), data, count * EEPROM_PAGE_SIZE) != SUCCESS)
+			continue;
+		for(index = 0; index < count; index++)
+		{
+			current = &data[index * EEPROM_PAGE_SIZE];
+			if(current[AUDIT_CRC_OFFSET] != AUDIT_pageCrc(current))
+				continue;
+			seq = current[AUDIT_SEQ_OFFSET] | ((uint16)current[AUDIT_SEQ_OFFSET + 1] << 8);
+			/* The sequence number wraps around, newer means ahead by less than half the range */
+			if(!g_hasPage || ((sint16)(seq - g_headSeq) > 0))
+			{
+				g_hasPage = TRUE;
+				g_headPage = page + index;
+				g_headSeq = seq;
+				g_boot = current[AUDIT_BOOT_OFFSET];
+			}
+		}
+	}
+	g_boot++;
+}
+
+/*
+ * Description:
+ * Add an event to the RAM buffer, the oldest buffered event is dropped if the buffer is full.
+ */
+void AUDIT_log(uint8 event, uint8 detail)
+{
+	uint8 *record;
+	uint16 seconds = (uint16)(TICK_getMs() / 1000);
+
+	if(g_buffered == AUDIT_BUFFER_RECORDS)
+	{
+		memmove(g_buffer, &g_buffer[AUDIT_RECORD_SIZE], (AUDIT_BUFFER_RECORDS - 1) * AUDIT_RECORD_SIZE);
+		g_buffered--;
+		/* The dropped event may be in the page being written, it is not dropped again after the write */
+		if(g_pageRecords != 0)
+			g_pageRecords--;
+	}
+	if(g_buffered == 0)
+		g_firstBufferedTime = TICK_getMs();
+
+	record = &g_buffer[g_buffered * AUDIT_RECORD_SIZE];
+	record[0] = event;
+	record[1] = detail;
+	record[2] = (uint8)seconds;
+	record[3] = (uint8)(seconds >> 8);
+	g_buffered++;
+}
+
+/*
+ * Description:
+ * Write a full page of buffered events, or the ones older than AUDIT_FLUSH_MS, in the background.
+ * A failed page is written again after AUDIT_FLUSH_MS. It must be called periodically.
+ */
+void AUDIT_task(void)
+{
+	AUDIT_endWrite();
+	if(((g_buffered >= AUDIT_RECORDS_PER_PAGE) && !g_writeFailed) ||
+	   ((g_buffered != 0) && (TICK_elapsedMs(g_firstBufferedTime) >= AUDIT_FLUSH_MS)))
+	{
+		AUDIT_writePage();
+	}
+}
+
+/*
+ * Description:
+ * Write all the buffered events now, stop at the first page that fails.
+ */
+void AUDIT_flush(void)
+{
+	while(g_buffered != 0)
+	{
+		/* A write already in progress is waited for, then the next page is written */
+		if(AUDIT_writePage() == ERROR)
+			return;
+		while(g_request.status == EEPROM_PENDING)
+		{
+			TWI_task();
+		}
+		AUDIT_endWrite();
+		if(g_writeFailed)
+			return;
+	}
+}
+
+/*
+ * Description:
+ * Copy the AUDIT_PAGE_DATA_SIZE bytes of a page, index 0 is the newest page.
+ * Return ERROR past the oldest page of the ring.
+ */
+uint8 AUDIT_readPage(uint8 index, uint8 *data)
+{
+	uint8 page[EEPROM_PAGE_SIZE];
+	uint16 seq;
+
+	if(!g_hasPage || (index >= AUDIT_PAGES_NUM))
+		return ERROR;
+
+	/* The pages before the newest one are contiguous in the ring, a blank or stale page ends it */
+	if(!AUDIT_readValidPage((g_headPage + AUDIT_PAGES_NUM - index) % AUDIT_PAGES_NUM, page))
+		return ERROR;
+	seq = page[AUDIT_SEQ_OFFSET] | ((uint16)page[AUDIT_SEQ_OFFSET + 1] << 8);
+	if(seq != (uint16)(g_headSeq - index))
+		return ERROR;
+
+	memcpy(data, page, AUDIT_PAGE_DATA_SIZE);
+	return SUCCESS;
+}
+
+/*
+ * Description:
+ * Return the inverted CRC-8 of a page, as stored in its last byte.
+ */
+static uint8 AUDIT_pageCrc(const uint8 *page)
+{
+	return (uint8)(CRC_calculate8(page, AUDIT_CRC_OFFSET) ^ 0xFF);
+}
+
+/*
+ * Description:
+ * Read a page of the ring, return TRUE if it is valid.
+ */
+static boolean AUDIT_readValidPage(uint8 page, uint8 *data)
+{
+	if(EEPROM_readBlock(AUDIT_PAGE_ADDRESS(page), data, EEPROM_PAGE_SIZE) != SUCCESS)
+		return FALSE;
+	return (data[AUDIT_CRC_OFFSET] == AUDIT_pageCrc(data));
+}
+
+/*
+ * Description:
+ * Copy up to one page of buffered events into the next page of the ring and start its write.
+ * Return EEPROM_PENDING if a page write is still in progress.
+ */
+static uint8 AUDIT_writePage(void)
+{
+	uint8 records = g_buffered, page = 0;
+
+	/* One page write at a time, the events wait in RAM meanwhile */
+	if(g_writing)
+		return EEPROM_PENDING;
+
+	if(records > AUDIT_RECORDS_PER_PAGE)
+		records = AUDIT_RECORDS_PER_PAGE;
+	if(g_hasPage)
+		page = (g_headPage + 1) % AUDIT_PAGES_NUM;
+
+	g_page[AUDIT_SEQ_OFFSET] = (uint8)(g_headSeq + 1);
+	g_page[AUDIT_SEQ_OFFSET + 1] = (uint8)((g_headSeq + 1) >> 8);
+	g_page[AUDIT_BOOT_OFFSET] = g_boot;
+	memset(&g_page[AUDIT_RECORDS_OFFSET], AUDIT_NO_EVENT, AUDIT_RECORDS_PER_PAGE * AUDIT_RECORD_SIZE);
+	memcpy(&g_page[AUDIT_RECORDS_OFFSET], g_buffer, records * AUDIT_RECORD_SIZE);
+	g_page[AUDIT_CRC_OFFSET] = AUDIT_pageCrc(g_page);
+
+	if(EEPROM_writeBlockAsync(&g_request, AUDIT_PAGE_ADDRESS(page), g_page, EEPROM_PAGE_SIZE, NULL_PTR) != SUCCESS)
+		return ERROR;
+
+	/* The events stay buffered until the page is stored */
+	g_writing = TRUE;
+	g_pageRecords = records;
+	return SUCCESS;
+}
+
+/*
+ * Description:
+ * Check the page write once it is done, the ring head moves and its events leave the buffer
+ * only if it succeeded, otherwise the same page is written again later.
+ */
+static void AUDIT_endWrite(void)
+{
+	if(!g_writing || (g_request.status == EEPROM_PENDING))
+		return;
+
+	g_writeFailed = (g_request.status != SUCCESS);
+	if(!g_writeFailed)
+	{
+		g_headPage = g_hasPage ? ((g_headPage + 1) % AUDIT_PAGES_NUM) : 0;
+		g_hasPage = TRUE;
+		g_headSeq++;
+
+		/* The events still buffered wait for the next page */
+		g_buffered -= g_pageRecords;
+		memmove(g_buffer, &g_buffer[g_pageRecords * AUDIT_RECORD_SIZE], g_buffered * AUDIT_RECORD_SIZE);
+	}
+	g_writing = FALSE;
+	g_pageRecords = 0;
+	g_firstBufferedTime = TICK_getMs();
+}
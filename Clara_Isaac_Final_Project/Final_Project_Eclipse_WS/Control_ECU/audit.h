@@ -0,0 +1,97 @@
+ /******************************************************************************
+ *
+ * Module: Audit
+ *
+ * File Name: audit.h
+ *
+ * Description: Header file for the access audit log, a ring of pages in the external
+ *              EEPROM. The events are buffered in RAM and written a whole page at a
+ *              time in the background, the log never waits for a write cycle.
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef AUDIT_H_
+#define AUDIT_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Pages of the ring, after the pages of the store, the page after them holds the wrong attempts count */
+#ifndef AUDIT_FIRST_PAGE
+#define AUDIT_FIRST_PAGE 32
+#endif
+#ifndef AUDIT_PAGES_NUM
+#define AUDIT_PAGES_NUM 31
+#endif
+
+/*
+ * Page: sequence number (2 bytes, little endian) | boot number | 3 records | inverted CRC-8 of the rest.
+ * Record: event | detail | seconds since the boot (2 bytes, little endian, wraps after 18 hours).
+ * An unused record of a page written by a timed flush has the event 0xFF.
+ */
+#define AUDIT_SEQ_OFFSET 0
+#define AUDIT_BOOT_OFFSET 2
+#define AUDIT_RECORDS_OFFSET 3
+#define AUDIT_RECORD_SIZE 4
+#define AUDIT_RECORDS_PER_PAGE 3
+#define AUDIT_PAGE_DATA_SIZE (3 + AUDIT_RECORDS_PER_PAGE * AUDIT_RECORD_SIZE) /* the page without its CRC */
+#define AUDIT_NO_EVENT 0xFF
+
+/* Records waiting in RAM, a full page is written at once, a part of it after AUDIT_FLUSH_MS */
+#define AUDIT_BUFFER_RECORDS (2 * AUDIT_RECORDS_PER_PAGE)
+#define AUDIT_FLUSH_MS 5000UL
+
+/* Events */
+#define AUDIT_BOOT 1 /* detail: 0 */
+#define AUDIT_PASS_SET 2 /* detail: 0 */
+#define AUDIT_OPEN 3 /* detail: 0 */
+#define AUDIT_WRONG_PASS 4 /* detail: consecutive wrong passwords */
+#define AUDIT_ALARM 5 /* detail: consecutive wrong passwords */
+#define AUDIT_PASS_CHANGED 6 /* detail: 0 with the password, 1 with a session token */
+#define AUDIT_LINK_DOWN 7 /* detail: the door state */
+#define AUDIT_USER_OPEN 8 /* detail: the user number */
+#define AUDIT_USER_CHANGED 9 /* detail: the user number */
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Find the newest page of the ring, the boot number of this run is the next one.
+ */
+void AUDIT_init(void);
+
+/*
+ * Description:
+ * Add an event to the RAM buffer, the oldest buffered event is dropped if the buffer is full.
+ */
+void AUDIT_log(uint8 event, uint8 detail);
+
+/*
+ * Description:
+ * Write a full page of buffered events, or the ones older than AUDIT_FLUSH_MS, in the background.
+ * It must be called periodically.
+ */
+void AUDIT_task(void);
+
+/*
+ * Description:
+ * Write all the buffered events now, in the background.
+ */
+void AUDIT_flush(void);
+
+/*
+ * Description:
+ * Copy the AUDIT_PAGE_DATA_SIZE bytes of a page, index 0 is the newest page.
+ * Return ERROR past the oldest page of the ring.
+ */
+uint8 AUDIT_readPage(uint8 index, uint8 *data);
+
+#endif /* AUDIT_H_ */
@@ -10,45 +10,168 @@
  *
  *******************************************************************************/
 
-#include "external_eeprom.h"
+#include "store.h"
+#include "audit.h"
+#include "users.h"
 #include "dc_motor.h"
 #include "buzzer.h"
 #include "timer1.h"
 #include "uart.h"
+#include "link.h"
 #include "twi.h"
+#include "tick.h"
+#include "crc.h"
 #include <avr/io.h> /* To use SREG register */
-#include <string.h> /* To use strcmp function */
-#include <util/delay.h> /* to use delay function */
+#include <string.h> /* To use memcmp, memcpy and memmove functions */
 
 #define FAILED 0u
 #define SUCCEED 1u
 
-#define CHECK_PASS 0x10
-#define INCORRECT_PASS 0x11
-#define OPEN_DOOR 0x12
-#define CHANGE_PASS 0x13
+/* Address of this door on the bus, every Control ECU is built with its own one (-DNODE_ADDRESS=n) */
+#ifndef NODE_ADDRESS
+#define NODE_ADDRESS 1
+#endif
+
+/*
+ * Requests, each one is answered by exactly one RESULT frame. The payload of a request starts with
+ * its sequence number and its RESULT starts with the same one. The HMI ECU sends a request again
+ * when its RESULT is lost, the same request within REPLAY_WINDOW_MS gets the cached RESULT again
+ * instead of being handled twice (a wrong password would count twice).
+ */
+#define REPLAY_WINDOW_MS 2000UL
+#define SET_PASS 0x14 /* payload: new pass + new pass again */
+#define AUTH_AND_OPEN 0x15 /* payload: pass */
+#define AUTH_AND_CHANGE 0x16 /* payload: old pass + new pass + new pass again */
+#define GET_STATUS 0x17 /* no payload, answered by RESULT_SUCCEED or RESULT_NO_PASS + the door state */
+#define CHANGE_WITH_TOKEN 0x19 /* payload: session token + new pass + new pass again */
+#define AUDIT_DUMP 0x1A /* payload: pass + page index (0 = newest), answered by RESULT_SUCCEED + the page or RESULT_REJECTED */
+#define USER_ADD 0x1B /* payload: pass + new PIN + new PIN again, answered by RESULT_SUCCEED + the user number */
+#define USER_SET 0x1C /* payload: pass + user number + USER_ENABLE, USER_DISABLE or USER_REMOVE */
+#define RESULT 0x20
+
+/* Door state events pushed to the HMI ECU, each one is acknowledged by an EVENT_ACK */
+#define DOOR_EVENT 0x21 /* payload: event */
+#define EVENT_ACK 0x22 /* payload: the acknowledged event */
+
+/* Events, the last published one is also the state of the door */
+#define DOOR_UNLOCKING 1 /* motor rotates clockwise for 15 sec */
+#define DOOR_HELD 2 /* motor stopped for 3 sec */
+#define DOOR_LOCKING 3 /* motor rotates anti-clockwise for 15 sec */
+#define DOOR_CLOSED 4 /* motor stopped, ready for requests */
+#define ALARM_START 5 /* buzzer is on for 1 min */
+#define ALARM_END 6 /* buzzer is off, ready for requests */
+
+/* Results */
+#define RESULT_SUCCEED 'S'
+#define RESULT_FAILED 'F' /* wrong password */
+#define RESULT_MISMATCH 'M' /* the 2 new passwords are not matched */
+#define RESULT_ALARM 'A' /* wrong password for the third time, alarm is on */
+#define RESULT_BUSY 'B' /* the door or the alarm sequence is still running */
+#define RESULT_NO_PASS 'N' /* the password of this door is not set yet */
+#define RESULT_NO_SESSION 'T' /* the session token is wrong or expired, the password is needed */
+#define RESULT_REJECTED 'R' /* the PIN is already used or the table is full, no such user or audit page */
+#define RESULT_NOT_SAVED 'E' /* the EEPROM write failed, the stored password is unchanged */
+
+/* Operations of USER_SET */
+#define USER_REMOVE 0
+#define USER_ENABLE 1
+#define USER_DISABLE 2
+
+/*
+ * An AUTH_AND_CHANGE with the correct old password and 2 different new ones opens a session,
+ * its RESULT_MISMATCH carries the token. The token replaces the old password only in the
+ * CHANGE_WITH_TOKEN that retries the new one right after, within SESSION_WINDOW_MS. Any other
+ * request, a wrong token, a successful change or the end of a door sequence closes the session.
+ */
+#define SESSION_TOKEN_LENGTH 4
+#ifndef SESSION_WINDOW_MS
+#define SESSION_WINDOW_MS 30000UL
+#endif
+
+#define PASS_LENGTH 5
+#define MAX_WRONG_ATTEMPTS 3
+
+/* Stored record: password | consecutive wrong passwords when the password was saved */
+#define RECORD_LENGTH (PASS_LENGTH + 1)
+
+/*
+ * Page of the wrong attempts count, after the audit ring: count | inverted count.
+ * It is written through the EEPROM write-behind cache, a restart doesn't clear the count.
+ */
+#define ATTEMPTS_PAGE (AUDIT_FIRST_PAGE + AUDIT_PAGES_NUM)
+#define ATTEMPTS_ADDRESS ((uint32)ATTEMPTS_PAGE * EEPROM_PAGE_SIZE)
+#if (ATTEMPTS_PAGE < STORE_FIRST_PAGE + STORE_PAGES_NUM) || (ATTEMPTS_PAGE >= USERS_FIRST_PAGE)
+#error "The wrong attempts page must be between the audit ring and the user table"
+#endif
 
 /*******************************************************************************
  *                       Variables Declarations                                *
  *******************************************************************************/
-uint8 g_counter = 0;
+volatile uint8 g_counter = 0; /* incremented by the Timer1 callback */
+uint8 g_wrongAttempts = 0; /* consecutive wrong passwords, stored in ATTEMPTS_PAGE */
+boolean g_passSet = FALSE; /* the first password is received from the HMI ECU or loaded at boot */
+uint8 g_passCache[PASS_LENGTH + 1]; /* RAM copy of the stored password and its inverted CRC-8 */
+uint8 g_state = DOOR_CLOSED; /* last published event */
+boolean g_eventPending = FALSE; /* the last event is not acknowledged yet */
+uint8 g_eventRetries = 0;
+uint32 g_eventSentTime = 0;
+boolean g_sessionOpen = FALSE; /* a change may be retried with the token */
+uint8 g_sessionToken[SESSION_TOKEN_LENGTH];
+uint32 g_sessionTime = 0; /* time of the AUTH_AND_CHANGE that opened the session */
+uint32 g_tokenSeed = 0x2545F491UL; /* state of the token generator, never 0 */
+uint8 g_requestType = 0; /* type and sequence number of the last request */
+uint8 g_requestSeq = 0;
+uint8 g_reply[LINK_MAX_PAYLOAD]; /* RESULT payload sent for the last request */
+uint8 g_replyLength = 0; /* 0 while the last request is not answered */
+uint32 g_replyTime = 0;
 
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
-uint8 APP_comparePass(uint8 pass[]); /* get 2 passwords from the HMI ECU and check if they are matched */
-void APP_savePass(void); /* save the password in EEPROM */
-void APP_checkPass(void); /* check if the password entered by user is matched to the one stored in EEPROM */
+boolean APP_isRequest(uint8 type); /* check if the frame type is one of the requests answered by a RESULT */
+boolean APP_startRequest(LINK_Frame *frame); /* take the sequence number off a request, answer a retry again */
+void APP_sendReply(const uint8 a_payload[], uint8 length); /* send the RESULT frame of the request and keep it */
+void APP_sendResult(uint8 result); /* send the result of the request to the HMI ECU */
+void APP_openSession(uint8 result); /* open a new session and send its token with the result */
+boolean APP_checkSession(const uint8 a_token[]); /* check the token of the open session */
+uint8 APP_comparePass(const uint8 a_passes[]); /* check if the 2 passwords are matched */
+uint8 APP_passCrc(const uint8 a_pass[]); /* the inverted CRC-8 kept after the password in the cache */
+boolean APP_loadPass(void); /* load the stored password into the RAM cache */
+uint8 APP_saveRecord(void); /* save the password and the wrong attempts count in EEPROM */
+void APP_loadAttempts(const uint8 a_count[]); /* load the stored wrong attempts count */
+void APP_saveAttempts(void); /* save the wrong attempts count through the EEPROM cache */
+uint8 APP_savePass(const uint8 a_pass[]); /* save the password in EEPROM */
+void APP_resetAttempts(void); /* clear the wrong attempts count after a correct password */
+void APP_setupPass(const LINK_Frame *frame); /* save the first password in EEPROM */
+uint8 APP_checkPass(const uint8 a_pass[]); /* check if the password entered by user is matched to the one stored in EEPROM */
+uint8 APP_authenticate(const uint8 a_pass[], uint8 *a_user); /* check the password or a user PIN and count the wrong attempts */
+void APP_authAndOpen(const LINK_Frame *frame); /* check the password then open the door */
+void APP_authAndChange(const LINK_Frame *frame); /* check the old password then save the new one */
+void APP_changeWithToken(const LINK_Frame *frame); /* check the session token then save the new password */
+boolean APP_isIdle(void); /* check that no door or alarm sequence is running */
+void APP_publishEvent(uint8 event); /* change the state and push it to the HMI ECU */
+void APP_eventTask(void); /* re-send the last event until the HMI ECU acknowledges it */
+void APP_startPhase(uint8 event, uint16 compare_value); /* publish the event and start timing its phase */
 void APP_openDoor(void); /* Rotate the DC motor for a specified time */
 void APP_alarm(void); /* Turn On the buzzer for 1 min */
+void APP_doorTask(void); /* move the door and alarm sequence to its next phase when the time is up */
+void APP_linkDown(void); /* lock the door when the HMI ECU is lost */
+void APP_auditDump(const LINK_Frame *frame); /* send one page of the audit log */
+void APP_userAdd(const LINK_Frame *frame); /* check the password then add a user PIN */
+void APP_userSet(const LINK_Frame *frame); /* check the password then enable, disable or remove a user */
 void APP_timerCounter(void); /* Callback function of Timer1 */
 
 int main(void)
 {
 	/* Variables Declaration */
-	uint8  a_state;
-	UART_ConfigType uart_config = {EIGHT_BIT, DISABLED, ONE_STOP_BIT, 9600}; /* UART configuration */
-	TWI_ConfigType twi_config = {0x01, 0x02}; /* TWI configuration */
+	LINK_Frame a_frame;
+	uint8 a_status[2];
+	UART_ConfigType uart_config = {NINE_BIT, DISABLED, ONE_STOP_BIT, BAUD_9600, INTERRUPT_MODE}; /* UART configuration */
+	TWI_ConfigType twi_config = {0x01, TWI_FAST_MODE}; /* TWI configuration, fastest legal SCL */
+	uint8 a_usersHeader[USERS_HEADER_SIZE], a_count[2], a_bootStatus;
+	/* Small ranges of the other modules, read at boot with the store slots */
+	EEPROM_Segment a_bootSegments[] = {{USERS_HEADER_ADDRESS, a_usersHeader, USERS_HEADER_SIZE},
+									   {ATTEMPTS_ADDRESS, a_count, 2}};
 
 	/* Enabling Global Interrupt Register */
 	SREG |= (1<<7);
@@ -57,28 +180,89 @@ int main(void)
 	DcMotor_Init();
 	/* Buzzer initialization*/
 	Buzzer_init();
-	/* UART initialization*/
+	/* System tick initialization, used for the link timeouts */
+	TICK_init();
+	/* UART initialization, the HMI ECU negotiates a faster rate later */
 	UART_init(&uart_config);
+	/* Only the frames addressed to this door wake the CPU up */
+	LINK_init(NODE_ADDRESS, LINK_HMI_ADDRESS);
 	/* TWI initialization*/
 	TWI_init(&twi_config);
+	/*
+	 * A valid password from the last run is kept, the setup is needed only on a blank EEPROM.
+	 * The user table header and the wrong attempts count come in the same TWI transaction.
+	 */
+	g_passSet = STORE_init(a_bootSegments, 2, &a_bootStatus) && APP_loadPass();
+	APP_loadAttempts((a_bootStatus == SUCCESS) ? a_count : NULL_PTR);
+	/*
+	 * The audit log goes on after the newest page of the last run, the whole ring is read
+	 * to find it so it has its own reads
+	 */
+	AUDIT_init();
+	AUDIT_log(AUDIT_BOOT, 0);
+	/* The user table is cleared on its first run */
+	USERS_init((a_bootStatus == SUCCESS) ? a_usersHeader : NULL_PTR);
 
-	APP_savePass(); /* get the password and save it in EEPROM */
 	while(1)
 	{
-		a_state = UART_recieveByte(); /* get the state from the HMI ECU */
-		switch(a_state)
+		/* the door and alarm sequences run while the link is served */
+		APP_doorTask();
+		APP_eventTask();
+		/* the EEPROM writes run in the background, a stuck TWI bus is recovered here */
+		AUDIT_task();
+		STORE_task();
+		EEPROM_task();
+		TWI_task();
+		if(!LINK_isUp())
+			APP_linkDown();
+
+		/* get the state from the HMI ECU, without waiting on the wire */
+		if(!LINK_receiveFrame(&a_frame))
+			continue;
+		if(APP_isRequest(a_frame.type) && !APP_startRequest(&a_frame))
+			continue;
+		/* the token serves only the retry that follows the AUTH_AND_CHANGE at once */
+		if(a_frame.type != CHANGE_WITH_TOKEN)
+			g_sessionOpen = FALSE;
+		/* the HMI ECU asks every door for its password first, every request but these 2 needs it */
+		if(!g_passSet && APP_isRequest(a_frame.type) && (a_frame.type != SET_PASS) && (a_frame.type != GET_STATUS))
+		{
+			APP_sendResult(RESULT_NO_PASS);
+			continue;
+		}
+		switch(a_frame.type)
 		{
-		case CHECK_PASS:
-			APP_checkPass();
+		case GET_STATUS:
+			/* the state ends the wait of the HMI ECU when the last event of a sequence is lost */
+			a_status[0] = g_passSet ? RESULT_SUCCEED : RESULT_NO_PASS;
+			a_status[1] = g_state;
+			APP_sendReply(a_status, 2);
 			break;
-		case OPEN_DOOR:
-			APP_openDoor();
+		case SET_PASS:
+			APP_setupPass(&a_frame);
 			break;
-		case CHANGE_PASS:
-			APP_savePass();
+		case AUTH_AND_OPEN:
+			APP_authAndOpen(&a_frame);
+			break;
+		case AUTH_AND_CHANGE:
+			APP_authAndChange(&a_frame);
+			break;
+		case CHANGE_WITH_TOKEN:
+			APP_changeWithToken(&a_frame);
+			break;
+		case AUDIT_DUMP:
+			APP_auditDump(&a_frame);
+			break;
+		case USER_ADD:
+			APP_userAdd(&a_frame);
+			break;
+		case USER_SET:
+			APP_userSet(&a_frame);
+			break;
+		case EVENT_ACK:
+			if((a_frame.length == 1) && (a_frame.payload[0] == g_state))
+				g_eventPending = FALSE;
 			break;
-		case INCORRECT_PASS:
-			APP_alarm();
 		}
 
 	}
@@ -90,104 +274,505 @@ int main(void)
 
 /*
  * Description:
- * Take 2 passwords from HMI ECU and compare them.
+ * Return TRUE if the frame type is one of the requests answered by a RESULT,
+ * the unassigned types between them are not.
  */
-uint8 APP_comparePass(uint8 a_pass1[])
+boolean APP_isRequest(uint8 type)
 {
-	/* Variable Declaration */
-	uint8 a_pass2[6];
-	/* Receive the 2 passwords */
-	UART_receiveString(a_pass1);
-	UART_receiveString(a_pass2);
+	switch(type)
+	{
+	case SET_PASS:
+	case AUTH_AND_OPEN:
+	case AUTH_AND_CHANGE:
+	case GET_STATUS:
+	case CHANGE_WITH_TOKEN:
+	case AUDIT_DUMP:
+	case USER_ADD:
+	case USER_SET:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/*
+ * Description:
+ * Take the sequence number off the payload of a request. Return FALSE if there is nothing
+ * to handle: the request has no sequence number, or it is the last request sent again
+ * and its RESULT is sent again.
+ */
+boolean APP_startRequest(LINK_Frame *frame)
+{
+	if(frame->length == 0)
+		return FALSE;
+	if((frame->type == g_requestType) && (frame->payload[0] == g_requestSeq) && (g_replyLength != 0)
+	   && (TICK_elapsedMs(g_replyTime) < REPLAY_WINDOW_MS))
+	{
+		LINK_sendFrame(RESULT, g_reply, g_replyLength);
+		return FALSE;
+	}
+	g_requestType = frame->type;
+	g_requestSeq = frame->payload[0];
+	g_replyLength = 0;
+	frame->length--;
+	memmove(frame->payload, &frame->payload[1], frame->length);
+	return TRUE;
+}
 
+/*
+ * Description:
+ * Send the RESULT frame of the request being handled, after its sequence number,
+ * it is kept for a retry of the same request.
+ */
+void APP_sendReply(const uint8 a_payload[], uint8 length)
+{
+	g_reply[0] = g_requestSeq;
+	memcpy(&g_reply[1], a_payload, length);
+	g_replyLength = 1 + length;
+	g_replyTime = TICK_getMs();
+	LINK_sendFrame(RESULT, g_reply, g_replyLength);
+}
+
+/*
+ * Description:
+ * Send the result of the last request to the HMI ECU.
+ */
+void APP_sendResult(uint8 result)
+{
+	APP_sendReply(&result, 1);
+}
+
+/*
+ * Description:
+ * Open a new session after a correct old password and send its token after the result.
+ * The token comes from a xorshift generator stirred with the time of every request,
+ * so it depends on when the user pressed the keys.
+ */
+void APP_openSession(uint8 result)
+{
+	/* Variables Declaration */
+	uint8 a_index, a_payload[1 + SESSION_TOKEN_LENGTH];
+
+	g_tokenSeed ^= TICK_getMs();
+	if(g_tokenSeed == 0)
+		g_tokenSeed = 0x2545F491UL;
+	for(a_index = 0; a_index < SESSION_TOKEN_LENGTH; a_index++)
+	{
+		g_tokenSeed ^= g_tokenSeed << 13;
+		g_tokenSeed ^= g_tokenSeed >> 17;
+		g_tokenSeed ^= g_tokenSeed << 5;
+		g_sessionToken[a_index] = (uint8)g_tokenSeed;
+	}
+	g_sessionOpen = TRUE;
+	g_sessionTime = TICK_getMs();
+
+	a_payload[0] = result;
+	memcpy(&a_payload[1], g_sessionToken, SESSION_TOKEN_LENGTH);
+	APP_sendReply(a_payload, 1 + SESSION_TOKEN_LENGTH);
+}
+
+/*
+ * Description:
+ * Return TRUE if the token is the one of the open session and the session window
+ * is not over yet, a wrong token closes the session so it can't be guessed.
+ */
+boolean APP_checkSession(const uint8 a_token[])
+{
+	if(g_sessionOpen && (TICK_elapsedMs(g_sessionTime) < SESSION_WINDOW_MS)
+	   && !(memcmp(a_token, g_sessionToken, SESSION_TOKEN_LENGTH)))
+		return TRUE;
+	g_sessionOpen = FALSE;
+	return FALSE;
+}
+
+/*
+ * Description:
+ * Compare the 2 passwords sent by the HMI ECU one after the other.
+ */
+uint8 APP_comparePass(const uint8 a_passes[])
+{
 	/* Compare the 2 passwords */
-	if (!(strcmp(a_pass1, a_pass2)))
+	if (!(memcmp(a_passes, &a_passes[PASS_LENGTH], PASS_LENGTH)))
 		return SUCCEED;
 	return FAILED;
 }
 
 /*
  * Description:
- * Keep checking if the passwords are matched or not, if yes,
- * Store the password in EEPROM.
+ * Return the inverted CRC-8 of the password, as kept after it in the cache.
  */
-void APP_savePass(void)
+uint8 APP_passCrc(const uint8 a_pass[])
 {
-	/* Variable Declaration */
-	uint8 a_index, a_pass[6];
-	/* if the 2 passwords are not matched send 'F' to Control ECU
-	 * to ask for another try. */
-	while(!(APP_comparePass(a_pass))){
-		UART_sendByte('F'); /* Failed = not matched */
+	return (uint8)(CRC_calculate8(a_pass, PASS_LENGTH) ^ 0xFF);
+}
+
+/*
+ * Description:
+ * Read the newest stored password into the RAM cache,
+ * return FALSE if there is none or it can't be read back.
+ */
+boolean APP_loadPass(void)
+{
+	uint8 a_record[RECORD_LENGTH];
+
+	/* The internal EEPROM mirror answers without a TWI transfer */
+	if(STORE_read(a_record, RECORD_LENGTH) != SUCCESS)
+		return FALSE;
+	memcpy(g_passCache, a_record, PASS_LENGTH);
+	g_passCache[PASS_LENGTH] = APP_passCrc(g_passCache);
+	return TRUE;
+}
+
+/*
+ * Description:
+ * Store the cached password and the wrong attempts count in EEPROM.
+ * Return ERROR if the record is not committed.
+ */
+uint8 APP_saveRecord(void)
+{
+	uint8 a_record[RECORD_LENGTH];
+
+	memcpy(a_record, g_passCache, PASS_LENGTH);
+	a_record[PASS_LENGTH] = g_wrongAttempts;
+	/*
+	 * Every change is appended to the next page of the log and mirrored in the internal EEPROM,
+	 * the result is sent once the log has it and the mirror is written meanwhile
+	 */
+	return STORE_append(a_record, RECORD_LENGTH);
+}
+
+/*
+ * Description:
+ * Read the wrong attempts count at boot from its page, or from the password record
+ * if the page was never written. a_count holds the 2 bytes of the page already read,
+ * NULL_PTR to read them here.
+ */
+void APP_loadAttempts(const uint8 a_count[])
+{
+	uint8 a_read[2], a_record[RECORD_LENGTH];
+
+	g_wrongAttempts = 0;
+	if((a_count == NULL_PTR) && (EEPROM_readBlock(ATTEMPTS_ADDRESS, a_read, 2) == SUCCESS))
+		a_count = a_read;
+	if((a_count != NULL_PTR) && ((a_count[0] ^ a_count[1]) == 0xFF))
+	{
+		a_record[PASS_LENGTH] = a_count[0];
 	}
-	UART_sendByte('S'); /* Succeed = matched */
-	/* Store the password in EEPROM */
-	for(a_index = 0; a_index < 6; a_index++)
+	else if(!g_passSet || (STORE_read(a_record, RECORD_LENGTH) != SUCCESS))
 	{
-		EEPROM_writeByte(0x0311+a_index, a_pass[a_index]);
-		_delay_ms(10);
+		return;
 	}
+	/* a record without the count (0xFF padding) counts as 0 */
+	if(a_record[PASS_LENGTH] < MAX_WRONG_ATTEMPTS)
+		g_wrongAttempts = a_record[PASS_LENGTH];
 }
 
 /*
  * Description:
- * check if the password is matched with the one stored in EEPROM
+ * Store the wrong attempts count without waiting: the EEPROM cache writes its page
+ * in the background once it is idle for EEPROM_CACHE_IDLE_MS.
  */
-void APP_checkPass(void)
+void APP_saveAttempts(void)
 {
-	/* Variables Declaration */
-	uint8 a_index, a_pass[6], a_passMCU1[6];
-	UART_receiveString(a_passMCU1); /* receive the password from HMI ECU */
+	uint8 a_count[2];
+
+	a_count[0] = g_wrongAttempts;
+	a_count[1] = (uint8)(g_wrongAttempts ^ 0xFF);
+	EEPROM_writeCached(ATTEMPTS_ADDRESS, a_count, 2);
+}
+
+/*
+ * Description:
+ * Store the password in EEPROM, write-through: the RAM cache is updated at once.
+ * Return ERROR if the EEPROM write failed, the cache is back to the old password then.
+ */
+uint8 APP_savePass(const uint8 a_pass[])
+{
+	uint8 a_old[PASS_LENGTH + 1];
+
+	memcpy(a_old, g_passCache, PASS_LENGTH + 1);
+	memcpy(g_passCache, a_pass, PASS_LENGTH);
+	g_passCache[PASS_LENGTH] = APP_passCrc(a_pass);
+	if(APP_saveRecord() == SUCCESS)
+		return SUCCESS;
+	/* the door keeps the password it would have after a restart */
+	memcpy(g_passCache, a_old, PASS_LENGTH + 1);
+	return ERROR;
+}
+
+/*
+ * Description:
+ * Clear the wrong attempts count after a correct password, it is stored only if it changes.
+ * A count that is not stored gives fewer tries after a restart only, it is not reported.
+ */
+void APP_resetAttempts(void)
+{
+	if(g_wrongAttempts == 0)
+		return;
+	g_wrongAttempts = 0;
+	APP_saveAttempts();
+}
 
-	/* read the stored password from EEPROM */
-	for(a_index = 0; a_index < 6; a_index++)
+/*
+ * Description:
+ * Handle SET_PASS: check if the first passwords are matched or not, if yes,
+ * Store the password in EEPROM. It is accepted only once, later changes need
+ * the old password (AUTH_AND_CHANGE).
+ */
+void APP_setupPass(const LINK_Frame *frame)
+{
+	if(g_passSet)
+	{
+		APP_sendResult(RESULT_FAILED);
+		return;
+	}
+	/* if the 2 passwords are not matched send 'F' to HMI ECU
+	 * to ask for another try. */
+	if((frame->length != 2 * PASS_LENGTH) || !(APP_comparePass(frame->payload)))
+	{
+		APP_sendResult(RESULT_FAILED); /* Failed = not matched */
+		return;
+	}
+	if(APP_savePass(frame->payload) != SUCCESS)
 	{
-		EEPROM_readByte(0x0311+a_index, &a_pass[a_index]);
-		_delay_ms(10);
+		APP_sendResult(RESULT_NOT_SAVED);
+		return;
 	}
+	APP_sendResult(RESULT_SUCCEED); /* Succeed = matched */
+	g_passSet = TRUE;
+	AUDIT_log(AUDIT_PASS_SET, 0);
+}
+
+/*
+ * Description:
+ * check if the password is matched with the one stored in EEPROM (its RAM cache)
+ */
+uint8 APP_checkPass(const uint8 a_pass[])
+{
+	/* The password is checked against the RAM cache, EEPROM is read again only if the cache is corrupted */
+	if((g_passCache[PASS_LENGTH] != APP_passCrc(g_passCache)) && !APP_loadPass())
+		return FAILED;
 	/* Compare the 2 passwords*/
-	if (!(strcmp(a_pass, a_passMCU1)))
+	if (!(memcmp(g_passCache, a_pass, PASS_LENGTH)))
+		return SUCCEED;
+	return FAILED;
+}
+
+/*
+ * Description:
+ * Check the password and count the consecutive wrong ones,
+ * the third wrong password in a row turns into RESULT_ALARM.
+ * If a_user is not NULL_PTR the PIN of an enabled user is accepted too, a_user is
+ * its number or USERS_NO_USER for the password.
+ */
+uint8 APP_authenticate(const uint8 a_pass[], uint8 *a_user)
+{
+	if(APP_checkPass(a_pass))
 	{
-		UART_sendByte('S'); /* Succeed = matched */
+		APP_resetAttempts();
+		if(a_user != NULL_PTR)
+			*a_user = USERS_NO_USER;
+		return RESULT_SUCCEED;
 	}
-	else
+	/* One page of the user table is read in the usual case, however many users there are */
+	if((a_user != NULL_PTR) && (USERS_find(a_pass, a_user) == USERS_ENABLED))
 	{
-		UART_sendByte('F'); /* Failed = not matched */
+		APP_resetAttempts();
+		return RESULT_SUCCEED;
 	}
+	g_sessionOpen = FALSE; /* someone else may be at the keypad */
+	g_wrongAttempts++;
+	AUDIT_log(AUDIT_WRONG_PASS, g_wrongAttempts);
+	if(g_wrongAttempts == MAX_WRONG_ATTEMPTS)
+	{
+		g_wrongAttempts = 0;
+		APP_saveAttempts();
+		return RESULT_ALARM;
+	}
+	/* restarting the door doesn't give more tries, the count in RAM holds if it is not stored */
+	APP_saveAttempts();
+	return RESULT_FAILED;
 }
 
 /*
  * Description:
- * Rotate the DC motor for a specified time.
+ * Handle AUTH_AND_OPEN: answer once, then open the door or turn the alarm on.
  */
-void APP_openDoor(void)
+void APP_authAndOpen(const LINK_Frame *frame)
 {
-	Timer1_ConfigType timer1_config = {0, 58593, F_CPU_1024, COMPARE_MODE}; /* timer1 configurations for 7.5 sec */
-	Timer1_setCallBack(APP_timerCounter); /* set timer1 Callback function */
+	/* Variable Declaration */
+	uint8 a_result, a_user;
 
-	DcMotor_Rotate(CLOCKWISE, 100); /* rotate the motor clockwise with max speed */
-	/* Start the timer */
-	Timer1_init(&timer1_config);
-	while(g_counter != 2){} /* wait until it finishes counting twice (15 sec) */
-	Timer1_deInit(); /* de-initialize the timer */
-	g_counter = 0;
+	if(!APP_isIdle())
+	{
+		APP_sendResult(RESULT_BUSY);
+		return;
+	}
+	if(frame->length != PASS_LENGTH)
+	{
+		APP_sendResult(RESULT_FAILED);
+		return;
+	}
+	a_result = APP_authenticate(frame->payload, &a_user);
+	/* Nothing follows an opening, no session is opened */
+	APP_sendResult(a_result);
+	if(a_result == RESULT_SUCCEED)
+	{
+		APP_openDoor();
+		if(a_user != USERS_NO_USER)
+			AUDIT_log(AUDIT_USER_OPEN, a_user);
+		else
+			AUDIT_log(AUDIT_OPEN, 0);
+	}
+	else if(a_result == RESULT_ALARM)
+	{
+		APP_alarm();
+	}
+}
 
-	DcMotor_Rotate(STOP, 0); /* Stop the motor */
-	timer1_config.compare_value = 23437; /* change compare value for 3 sec */
-	/* Start the timer */
-	Timer1_init(&timer1_config);
-	while(g_counter != 1){} /* wait until it finishes counting*/
-	Timer1_deInit(); /* de-initialize the timer */
-	g_counter = 0;
+/*
+ * Description:
+ * Handle AUTH_AND_CHANGE: check the old password and save the new one if
+ * it is entered twice the same, answer once.
+ */
+void APP_authAndChange(const LINK_Frame *frame)
+{
+	/* Variable Declaration */
+	uint8 a_result;
 
-	DcMotor_Rotate(ANTI_CLOCKWISE, 100); /* rotate the motor anti-clockwise with max speed */
-	timer1_config.compare_value = 58593; /* change compare value for 7.5 sec */
-	/* Start the timer */
-	Timer1_init(&timer1_config);
-	while(g_counter != 2){} /* wait until it finishes counting twice (15 sec) */
-	Timer1_deInit(); /* de-initialize the timer */
+	if(!APP_isIdle())
+	{
+		APP_sendResult(RESULT_BUSY);
+		return;
+	}
+	if(frame->length != 3 * PASS_LENGTH)
+	{
+		APP_sendResult(RESULT_FAILED);
+		return;
+	}
+	a_result = APP_authenticate(frame->payload, NULL_PTR);
+	if((a_result == RESULT_SUCCEED) && !(APP_comparePass(&frame->payload[PASS_LENGTH])))
+		a_result = RESULT_MISMATCH;
+	if(a_result == RESULT_MISMATCH)
+	{
+		/* the old password is correct, the new one is retried with the token */
+		APP_openSession(a_result);
+		return;
+	}
+	if(a_result == RESULT_SUCCEED)
+	{
+		if(APP_savePass(&frame->payload[PASS_LENGTH]) != SUCCESS)
+			a_result = RESULT_NOT_SAVED;
+		else
+			AUDIT_log(AUDIT_PASS_CHANGED, 0);
+	}
+	APP_sendResult(a_result);
+	if(a_result == RESULT_ALARM)
+		APP_alarm();
+}
+
+/*
+ * Description:
+ * Handle CHANGE_WITH_TOKEN: save the new password if the token is the one of the open session
+ * and the new password is entered twice the same. The session ends with the change.
+ */
+void APP_changeWithToken(const LINK_Frame *frame)
+{
+	if(!APP_isIdle())
+	{
+		APP_sendResult(RESULT_BUSY);
+		return;
+	}
+	if((frame->length != SESSION_TOKEN_LENGTH + 2 * PASS_LENGTH) || !APP_checkSession(frame->payload))
+	{
+		APP_sendResult(RESULT_NO_SESSION);
+		return;
+	}
+	if(!(APP_comparePass(&frame->payload[SESSION_TOKEN_LENGTH])))
+	{
+		APP_sendResult(RESULT_MISMATCH);
+		return;
+	}
+	g_sessionOpen = FALSE;
+	if(APP_savePass(&frame->payload[SESSION_TOKEN_LENGTH]) != SUCCESS)
+	{
+		APP_sendResult(RESULT_NOT_SAVED);
+		return;
+	}
+	APP_sendResult(RESULT_SUCCEED);
+	AUDIT_log(AUDIT_PASS_CHANGED, 1);
+}
+
+/*
+ * Description:
+ * Return TRUE if the door is closed and the alarm is off, the last event ended a sequence.
+ */
+boolean APP_isIdle(void)
+{
+	return (g_state == DOOR_CLOSED) || (g_state == ALARM_END);
+}
+
+/*
+ * Description:
+ * Change the state of the door and push it to the HMI ECU,
+ * it is re-sent by APP_eventTask until the HMI ECU acknowledges it.
+ */
+void APP_publishEvent(uint8 event)
+{
+	/* the user may have walked away after the door closed */
+	if(event == DOOR_CLOSED)
+		g_sessionOpen = FALSE;
+	g_state = event;
+	g_eventPending = TRUE;
+	g_eventRetries = 0;
+	g_eventSentTime = TICK_getMs();
+	LINK_sendFrame(DOOR_EVENT, &event, 1);
+}
+
+/*
+ * Description:
+ * Re-send the last event if it is not acknowledged in time.
+ */
+void APP_eventTask(void)
+{
+	if(!g_eventPending || (TICK_elapsedMs(g_eventSentTime) < LINK_REPLY_TIMEOUT_MS))
+		return;
+	if(g_eventRetries == LINK_REQUEST_RETRIES)
+	{
+		g_eventPending = FALSE; /* give up, the HMI ECU is not listening */
+		return;
+	}
+	g_eventRetries++;
+	g_eventSentTime = TICK_getMs();
+	LINK_sendFrame(DOOR_EVENT, &g_state, 1);
+}
+
+/*
+ * Description:
+ * Publish the event of a new phase and start Timer1 for it,
+ * APP_doorTask counts the compare matches to end the phase.
+ */
+void APP_startPhase(uint8 event, uint16 compare_value)
+{
+	Timer1_ConfigType timer1_config = {0, 0, F_CPU_1024, COMPARE_MODE};
+	timer1_config.compare_value = compare_value;
+
+	Timer1_deInit(); /* de-initialize the timer of the last phase */
 	g_counter = 0;
-	DcMotor_Rotate(STOP, 0); /* Stop the motor */
+	Timer1_setCallBack(APP_timerCounter); /* set timer1 Callback function */
+	Timer1_init(&timer1_config);
+	APP_publishEvent(event);
+}
+
+/*
+ * Description:
+ * Rotate the DC motor for a specified time.
+ * Only the first phase is started here, APP_doorTask runs the rest.
+ */
+void APP_openDoor(void)
+{
+	DcMotor_Rotate(CLOCKWISE, 100); /* rotate the motor clockwise with max speed */
+	APP_startPhase(DOOR_UNLOCKING, 58593); /* 7.5 sec, counted twice (15 sec) */
 }
 
 /*
@@ -196,15 +781,183 @@ void APP_openDoor(void)
  */
 void APP_alarm(void)
 {
-	Timer1_ConfigType timer1_config = {0, 46875, F_CPU_1024, COMPARE_MODE}; /* timer1 configurations for 6 sec */
-	Timer1_setCallBack(APP_timerCounter); /* set timer1 Callback function */
 	Buzzer_on(); /* Turn On the buzzer */
-	/* Start the timer */
-	Timer1_init(&timer1_config);
-	while(g_counter != 10){} /* wait until it finishes counting 10 times (1 min) */
-	Timer1_deInit(); /* de-initialize the timer */
-	g_counter = 0;
-	Buzzer_off(); /* Turn Off the buzzer */
+	AUDIT_log(AUDIT_ALARM, MAX_WRONG_ATTEMPTS);
+	/* the cleared count is stored now, the door is locked for the alarm minute anyway */
+	EEPROM_flush();
+	APP_startPhase(ALARM_START, 46875); /* 6 sec, counted 10 times (1 min) */
+}
+
+/*
+ * Description:
+ * Move the door and alarm sequence to its next phase when the time of the current one is up.
+ */
+void APP_doorTask(void)
+{
+	switch(g_state)
+	{
+	case DOOR_UNLOCKING:
+		if(g_counter == 2) /* 15 sec */
+		{
+			DcMotor_Rotate(STOP, 0); /* Stop the motor */
+			APP_startPhase(DOOR_HELD, 23437); /* 3 sec */
+		}
+		break;
+	case DOOR_HELD:
+		if(g_counter == 1) /* 3 sec */
+		{
+			DcMotor_Rotate(ANTI_CLOCKWISE, 100); /* rotate the motor anti-clockwise with max speed */
+			APP_startPhase(DOOR_LOCKING, 58593); /* 7.5 sec, counted twice (15 sec) */
+		}
+		break;
+	case DOOR_LOCKING:
+		if(g_counter == 2) /* 15 sec */
+		{
+			Timer1_deInit(); /* de-initialize the timer */
+			DcMotor_Rotate(STOP, 0); /* Stop the motor */
+			APP_publishEvent(DOOR_CLOSED);
+		}
+		break;
+	case ALARM_START:
+		if(g_counter == 10) /* 1 min */
+		{
+			Timer1_deInit(); /* de-initialize the timer */
+			Buzzer_off(); /* Turn Off the buzzer */
+			APP_publishEvent(ALARM_END);
+		}
+		break;
+	}
+}
+
+/*
+ * Description:
+ * The HMI ECU or the cable is lost: nobody watches an open door, so start locking it at once,
+ * the alarm keeps running. The session is closed, the password is needed after the link is back.
+ */
+void APP_linkDown(void)
+{
+	g_sessionOpen = FALSE;
+	if((g_state == DOOR_UNLOCKING) || (g_state == DOOR_HELD))
+	{
+		AUDIT_log(AUDIT_LINK_DOWN, g_state);
+		DcMotor_Rotate(ANTI_CLOCKWISE, 100); /* rotate the motor anti-clockwise with max speed */
+		APP_startPhase(DOOR_LOCKING, 58593); /* 7.5 sec, counted twice (15 sec) */
+	}
+}
+
+/*
+ * Description:
+ * Handle AUDIT_DUMP: check the password, then send the boot number and the records of the requested
+ * page of the audit log, the events still in RAM are written first so the newest page holds them.
+ */
+void APP_auditDump(const LINK_Frame *frame)
+{
+	uint8 a_page[AUDIT_PAGE_DATA_SIZE], a_reply[1 + AUDIT_PAGE_DATA_SIZE - AUDIT_BOOT_OFFSET], a_result;
+
+	if(!APP_isIdle())
+	{
+		APP_sendResult(RESULT_BUSY);
+		return;
+	}
+	if(frame->length != PASS_LENGTH + 1)
+	{
+		APP_sendResult(RESULT_FAILED);
+		return;
+	}
+	/* only the password reads the log, a wrong one counts like any other */
+	a_result = APP_authenticate(frame->payload, NULL_PTR);
+	if(a_result != RESULT_SUCCEED)
+	{
+		APP_sendResult(a_result);
+		if(a_result == RESULT_ALARM)
+			APP_alarm();
+		return;
+	}
+	if(frame->payload[PASS_LENGTH] == 0)
+		AUDIT_flush();
+	if(AUDIT_readPage(frame->payload[PASS_LENGTH], a_page) != SUCCESS)
+	{
+		APP_sendResult(RESULT_REJECTED); /* past the oldest page */
+		return;
+	}
+	/* the sequence number of the page is left out, the RESULT has no room for it after its own one */
+	a_reply[0] = RESULT_SUCCEED;
+	memcpy(&a_reply[1], &a_page[AUDIT_BOOT_OFFSET], AUDIT_PAGE_DATA_SIZE - AUDIT_BOOT_OFFSET);
+	APP_sendReply(a_reply, sizeof(a_reply));
+}
+
+/*
+ * Description:
+ * Handle USER_ADD: check the password, then add the new PIN if it is entered twice the same
+ * and answer with the number of the new user.
+ */
+void APP_userAdd(const LINK_Frame *frame)
+{
+	/* Variable Declaration */
+	uint8 a_reply[2];
+
+	if(!APP_isIdle())
+	{
+		APP_sendResult(RESULT_BUSY);
+		return;
+	}
+	if(frame->length != 3 * PASS_LENGTH)
+	{
+		APP_sendResult(RESULT_FAILED);
+		return;
+	}
+	a_reply[0] = APP_authenticate(frame->payload, NULL_PTR);
+	if((a_reply[0] == RESULT_SUCCEED) && !(APP_comparePass(&frame->payload[PASS_LENGTH])))
+		a_reply[0] = RESULT_MISMATCH;
+	else if((a_reply[0] == RESULT_SUCCEED) && (USERS_add(&frame->payload[PASS_LENGTH], &a_reply[1]) != SUCCESS))
+		a_reply[0] = RESULT_REJECTED;
+	if(a_reply[0] != RESULT_SUCCEED)
+	{
+		APP_sendResult(a_reply[0]);
+		if(a_reply[0] == RESULT_ALARM)
+			APP_alarm();
+		return;
+	}
+	APP_sendReply(a_reply, 2);
+	AUDIT_log(AUDIT_USER_CHANGED, a_reply[1]);
+}
+
+/*
+ * Description:
+ * Handle USER_SET: check the password, then enable, disable or remove the user.
+ */
+void APP_userSet(const LINK_Frame *frame)
+{
+	/* Variable Declaration */
+	uint8 a_result, a_state;
+
+	if(!APP_isIdle())
+	{
+		APP_sendResult(RESULT_BUSY);
+		return;
+	}
+	if(frame->length != PASS_LENGTH + 2)
+	{
+		APP_sendResult(RESULT_FAILED);
+		return;
+	}
+	switch(frame->payload[PASS_LENGTH + 1])
+	{
+	case USER_REMOVE: a_state = USERS_REMOVED; break;
+	case USER_ENABLE: a_state = USERS_ENABLED; break;
+	case USER_DISABLE: a_state = USERS_DISABLED; break;
+	default:
+		APP_sendResult(RESULT_FAILED);
+		return;
+	}
+	a_result = APP_authenticate(frame->payload, NULL_PTR);
+	if((a_result == RESULT_SUCCEED) && (USERS_setState(frame->payload[PASS_LENGTH], a_state) != SUCCESS))
+		a_result = RESULT_REJECTED;
+	APP_sendResult(a_result);
+	if(a_result == RESULT_ALARM)
+		APP_alarm();
+	else if(a_result == RESULT_SUCCEED)
+		AUDIT_log(AUDIT_USER_CHANGED, frame->payload[PASS_LENGTH]);
 }
 
 /* Callback function of Timer1 */
@@ -10,73 +10,648 @@
  *
  *******************************************************************************/
 #include "external_eeprom.h"
-#include "twi.h"
-
-uint8 EEPROM_writeByte(uint16 u16addr, uint8 u8data)
-{
-	/* Send the Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=0 (write) */
-    TWI_writeByte((uint8)(0xA0 | ((u16addr & 0x0700)>>7)));
-    if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-        return ERROR; 
-		 
-    /* Send the required memory location address */
-    TWI_writeByte((uint8)(u16addr));
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
-        return ERROR;
-		
-    /* write byte to eeprom */
-    TWI_writeByte(u8data);
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
-        return ERROR;
-
-    /* Send the Stop Bit */
-    TWI_stop();
-	
-    return SUCCESS;
-}
-
-uint8 EEPROM_readByte(uint16 u16addr, uint8 *u8data)
-{
-	/* Send the Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=0 (write) */
-    TWI_writeByte((uint8)((0xA0) | ((u16addr & 0x0700)>>7)));
-    if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-        return ERROR;
-		
-    /* Send the required memory location address */
-    TWI_writeByte((uint8)(u16addr));
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
-        return ERROR;
-		
-    /* Send the Repeated Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_REP_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=1 (Read) */
-    TWI_writeByte((uint8)((0xA0) | ((u16addr & 0x0700)>>7) | 1));
-    if (TWI_getStatus() != TWI_MT_SLA_R_ACK)
-        return ERROR;
-
-    /* Read Byte from Memory without send ACK */
-    *u8data = TWI_readByteWithNACK();
-    if (TWI_getStatus() != TWI_MR_DATA_NACK)
-        return ERROR;
-
-    /* Send the Stop Bit */
-    TWI_stop();
-
-    return SUCCESS;
+#include "tick.h"
+
+#define EEPROM_DEVICE_ENTRY(sla, address_bytes, page_size, size) {sla, address_bytes, page_size, size},
+
+/* Checks of the address map, each one sums a term per device */
+#define EEPROM_DEVICE_ONE(sla, address_bytes, page_size, size) + 1
+#define EEPROM_DEVICE_BAD_PAGE(sla, address_bytes, page_size, size) + (((page_size) % EEPROM_PAGE_SIZE) != 0)
+/* Device addresses 0xA0 - 0xAE taken by a device, one bit each: a 1 address byte device takes one per 256 bytes */
+#define EEPROM_DEVICE_BLOCKS(address_bytes, size) (((address_bytes) == 1) ? (((size) + 255) / 256) : 1)
+#define EEPROM_DEVICE_BITS(sla, address_bytes, page_size, size) \
+	((((1UL << EEPROM_DEVICE_BLOCKS(address_bytes, size)) - 1) << (((sla) >> 1) & 7)))
+#define EEPROM_DEVICE_BITS_SUM(sla, address_bytes, page_size, size) + EEPROM_DEVICE_BITS(sla, address_bytes, page_size, size)
+#define EEPROM_DEVICE_BITS_OR(sla, address_bytes, page_size, size) | EEPROM_DEVICE_BITS(sla, address_bytes, page_size, size)
+
+#if (EEPROM_PAGE_SIZE > 16)
+#error "The dirty bits of a cached page are 16 bits"
+#endif
+#if (0 EEPROM_DEVICES(EEPROM_DEVICE_ONE)) > 8
+#error "g_writeBusy has one bit per device, at most 8 devices"
+#endif
+#if (0 EEPROM_DEVICES(EEPROM_DEVICE_BAD_PAGE)) != 0
+#error "The page size of every device must be a multiple of EEPROM_PAGE_SIZE"
+#endif
+/* A device address taken twice is counted twice by the sum and once by the or */
+#if ((0 EEPROM_DEVICES(EEPROM_DEVICE_BITS_SUM)) != (0 EEPROM_DEVICES(EEPROM_DEVICE_BITS_OR))) || \
+	((0 EEPROM_DEVICES(EEPROM_DEVICE_BITS_OR)) > 0xFF)
+#error "The device addresses overlap, a 24C16 takes the addresses of its 8 blocks"
+#endif
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* One bit per device: a write cycle was started by its last job and may still be running, written by the TWI ISR */
+static volatile uint8 g_writeBusy = 0;
+
+/* Address map, the first device starts at 0 and every next one after the last one */
+static const EEPROM_Device g_devices[] = {EEPROM_DEVICES(EEPROM_DEVICE_ENTRY)};
+#define EEPROM_DEVICES_NUM (sizeof(g_devices) / sizeof(g_devices[0]))
+
+/* Pages of the write-behind cache */
+static EEPROM_CachePage g_cache[EEPROM_CACHE_PAGES]; /* a page without dirty bytes is free */
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Check the range and the request, then queue its first job.
+ */
+static uint8 EEPROM_startRequest(EEPROM_Request *request, uint32 u32addr, const uint8 *tx_data,
+								 uint8 *rx_data, uint16 len, void (*callback)(EEPROM_Request *request));
+
+/*
+ * Description :
+ * Return the device of an address of the linear address space and the offset inside it.
+ */
+static const EEPROM_Device *EEPROM_findDevice(uint32 address, uint32 *offset);
+
+/*
+ * Description :
+ * Set up the TWI job of a memory location address and return the index of its device.
+ * The length is cut at the end of the page in a write and at the end of the device in a read.
+ */
+static uint8 EEPROM_setupJob(TWI_Job *job, uint8 *location, uint32 address, uint16 length, boolean read);
+
+/*
+ * Description :
+ * Queue the TWI job of the next page of a write, or of the read inside one device.
+ */
+static void EEPROM_submitJob(EEPROM_Request *request);
+
+/*
+ * Description :
+ * TWI job callback: queue the next page or end the request.
+ */
+static void EEPROM_onJobDone(TWI_Job *job);
+
+/*
+ * Description :
+ * Wait until a request started by a blocking function ends and return its status.
+ */
+static uint8 EEPROM_wait(EEPROM_Request *request);
+
+/*
+ * Description :
+ * Copy the cached bytes not stored yet over the bytes read from the device.
+ */
+static void EEPROM_cacheOverlay(uint32 u32addr, uint8 *data, uint16 len);
+
+/*
+ * Description :
+ * A direct write is newer than the cached bytes of its range, take its bytes in the cache.
+ */
+static void EEPROM_cacheOverride(uint32 u32addr, const uint8 *data, uint16 len);
+
+/*
+ * Description :
+ * Return the cached page of an address, a free or the oldest one is taken for a new page.
+ * Return NULL_PTR if the oldest page can't be stored to free it.
+ */
+static EEPROM_CachePage *EEPROM_cachePage(uint32 page);
+
+/*
+ * Description :
+ * Start the write of the dirty bytes of a cached page in the background.
+ * If wait is FALSE nothing is done while the last write of the page is still running.
+ */
+static uint8 EEPROM_flushPage(EEPROM_CachePage *cache, boolean wait);
+
+/*
+ * Description :
+ * Check the last write of a cached page once it is done: the bytes it sent are clean
+ * if it succeeded and stay dirty for the next write if it failed.
+ */
+static void EEPROM_endPageWrite(EEPROM_CachePage *cache);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+uint8 EEPROM_writeByte(uint32 u32addr, uint8 u8data)
+{
+	return EEPROM_writeBlock(u32addr, &u8data, 1);
+}
+
+uint8 EEPROM_readByte(uint32 u32addr, uint8 *u8data)
+{
+	return EEPROM_readBlock(u32addr, u8data, 1);
+}
+
+/*
+ * Description :
+ * Write len bytes from u32addr, split on the page boundaries of the devices so each page
+ * is written by one start / address / data burst / stop sequence and one write cycle.
+ * It returns after the write cycle of the last page has started, the pages before it
+ * are waited by acknowledge polling.
+ */
+uint8 EEPROM_writeBlock(uint32 u32addr, const uint8 *data, uint16 len)
+{
+	EEPROM_Request request = {.status = ERROR};
+
+	if(EEPROM_writeBlockAsync(&request, u32addr, data, len, NULL_PTR) != SUCCESS)
+		return ERROR;
+	return EEPROM_wait(&request);
+}
+
+/*
+ * Description :
+ * Read len bytes from u32addr with one addressing phase per device (sequential read),
+ * every byte is acknowledged except the last one.
+ */
+uint8 EEPROM_readBlock(uint32 u32addr, uint8 *data, uint16 len)
+{
+	EEPROM_Request request = {.status = ERROR};
+
+	if(EEPROM_readBlockAsync(&request, u32addr, data, len, NULL_PTR) != SUCCESS)
+		return ERROR;
+	if(EEPROM_wait(&request) != SUCCESS)
+		return ERROR;
+	EEPROM_cacheOverlay(u32addr, data, len);
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Read several ranges in one TWI transaction: the addressing phase and the read of each
+ * range follow the previous one with a repeated start, the stop is sent after the last one.
+ * Return ERROR if a range is wrong, the ranges take more than EEPROM_SEGMENT_MAX_JOBS jobs
+ * or a read fails.
+ */
+uint8 EEPROM_readSegments(const EEPROM_Segment *segments, uint8 count)
+{
+	TWI_Job jobs[EEPROM_SEGMENT_MAX_JOBS];
+	uint8 locations[EEPROM_SEGMENT_MAX_JOBS][2], index, jobs_num = 0, *data;
+	uint32 address;
+	uint16 remaining;
+
+	for(index = 0; index < count; index++)
+	{
+		if((segments[index].len == 0) || ((segments[index].address + segments[index].len) > EEPROM_SIZE))
+			return ERROR;
+		address = segments[index].address;
+		data = segments[index].data;
+		remaining = segments[index].len;
+		/* One job per device of the range */
+		while(remaining != 0)
+		{
+			if(jobs_num == EEPROM_SEGMENT_MAX_JOBS)
+				return ERROR;
+			EEPROM_setupJob(&jobs[jobs_num], locations[jobs_num], address, remaining, TRUE);
+			jobs[jobs_num].rx_data = data;
+			jobs[jobs_num].callback = NULL_PTR;
+			jobs[jobs_num].status = TWI_JOB_IDLE;
+			if(jobs_num != 0)
+				jobs[jobs_num - 1].chain = &jobs[jobs_num];
+			address += jobs[jobs_num].length;
+			data += jobs[jobs_num].length;
+			remaining -= jobs[jobs_num].length;
+			jobs_num++;
+		}
+	}
+	if(jobs_num == 0)
+		return SUCCESS;
+
+	/* The jobs of a transaction run in order, it is over when the last one ends */
+	if(!TWI_submit(&jobs[0]))
+		return ERROR;
+	while(jobs[jobs_num - 1].status == TWI_JOB_QUEUED)
+	{
+		TWI_task();
+	}
+	for(index = 0; index < jobs_num; index++)
+	{
+		if(jobs[index].status != TWI_JOB_DONE)
+			return ERROR;
+	}
+	for(index = 0; index < count; index++)
+	{
+		EEPROM_cacheOverlay(segments[index].address, segments[index].data, segments[index].len);
+	}
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Start EEPROM_writeBlock in the background and return at once. The data must stay
+ * unchanged until request->status leaves EEPROM_PENDING, then the callback is called.
+ * Return ERROR if the range is wrong or the request is still pending.
+ */
+uint8 EEPROM_writeBlockAsync(EEPROM_Request *request, uint32 u32addr, const uint8 *data, uint16 len,
+							 void (*callback)(EEPROM_Request *request))
+{
+	if(EEPROM_startRequest(request, u32addr, data, NULL_PTR, len, callback) != SUCCESS)
+		return ERROR;
+	EEPROM_cacheOverride(u32addr, data, len);
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Start EEPROM_readBlock in the background and return at once,
+ * data is valid when request->status is SUCCESS.
+ * Return ERROR if the range is wrong or the request is still pending.
+ */
+uint8 EEPROM_readBlockAsync(EEPROM_Request *request, uint32 u32addr, uint8 *data, uint16 len,
+							void (*callback)(EEPROM_Request *request))
+{
+	return EEPROM_startRequest(request, u32addr, NULL_PTR, data, len, callback);
+}
+
+/*
+ * Description :
+ * Write len bytes through the write-behind cache and return at once, repeated writes to
+ * the same page are merged into one page write. It waits only when no RAM page is free:
+ * the oldest one is written first. EEPROM_readByte, EEPROM_readBlock and EEPROM_readSegments
+ * see the cached bytes, EEPROM_readBlockAsync reads the device only.
+ * Return ERROR if the range is wrong or no RAM page could be freed.
+ */
+uint8 EEPROM_writeCached(uint32 u32addr, const uint8 *data, uint16 len)
+{
+	EEPROM_CachePage *cache;
+	uint8 offset;
+
+	if((len == 0) || ((u32addr + len) > EEPROM_SIZE))
+		return ERROR;
+
+	while(len != 0)
+	{
+		cache = EEPROM_cachePage(u32addr & ~(uint32)(EEPROM_PAGE_SIZE - 1));
+		if(cache == NULL_PTR)
+			return ERROR;
+		if(cache->dirty == 0)
+			cache->first_change = TICK_getMs();
+		cache->last_change = TICK_getMs();
+		/* Bytes of the same page are merged until the page is written */
+		do
+		{
+			offset = u32addr & (EEPROM_PAGE_SIZE - 1);
+			cache->data[offset] = *data++;
+			cache->dirty |= (uint16)1 << offset;
+			/* A byte changed while its old value is on the bus stays dirty after that write */
+			cache->writing &= ~((uint16)1 << offset);
+			u32addr++;
+			len--;
+		}while((len != 0) && ((u32addr & (EEPROM_PAGE_SIZE - 1)) != 0));
+	}
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Start the write of the cached pages that are idle or past their deadline.
+ * It must be called periodically.
+ */
+void EEPROM_task(void)
+{
+	uint8 index;
+	EEPROM_CachePage *cache;
+
+	for(index = 0; index < EEPROM_CACHE_PAGES; index++)
+	{
+		cache = &g_cache[index];
+		EEPROM_endPageWrite(cache);
+		if((cache->dirty != 0) &&
+		   ((TICK_elapsedMs(cache->last_change) >= EEPROM_CACHE_IDLE_MS) ||
+			(TICK_elapsedMs(cache->first_change) >= EEPROM_CACHE_DEADLINE_MS)))
+		{
+			EEPROM_flushPage(cache, FALSE);
+		}
+	}
+}
+
+/*
+ * Description :
+ * Write all the cached pages and wait until they are stored,
+ * return ERROR if one of them is still not stored.
+ */
+uint8 EEPROM_flush(void)
+{
+	uint8 index, status = SUCCESS;
+
+	for(index = 0; index < EEPROM_CACHE_PAGES; index++)
+	{
+		EEPROM_flushPage(&g_cache[index], TRUE);
+	}
+	for(index = 0; index < EEPROM_CACHE_PAGES; index++)
+	{
+		EEPROM_wait(&g_cache[index].request);
+		EEPROM_endPageWrite(&g_cache[index]);
+		if(g_cache[index].dirty != 0)
+			status = ERROR;
+	}
+	return status;
+}
+
+/*
+ * Description :
+ * Check the range and the request, then queue its first job.
+ */
+static uint8 EEPROM_startRequest(EEPROM_Request *request, uint32 u32addr, const uint8 *tx_data,
+								 uint8 *rx_data, uint16 len, void (*callback)(EEPROM_Request *request))
+{
+	if((request->status == EEPROM_PENDING) || (len == 0) || ((u32addr + len) > EEPROM_SIZE))
+		return ERROR;
+
+	request->address = u32addr;
+	request->tx_data = tx_data;
+	request->rx_data = rx_data;
+	request->remaining = len;
+	request->callback = callback;
+	request->status = EEPROM_PENDING;
+	request->job.status = TWI_JOB_IDLE;
+	request->job.callback = EEPROM_onJobDone;
+	request->job.context = request;
+	EEPROM_submitJob(request);
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Return the device of an address of the linear address space and the offset inside it.
+ */
+static const EEPROM_Device *EEPROM_findDevice(uint32 address, uint32 *offset)
+{
+	const EEPROM_Device *device = g_devices;
+
+	/* The range of the request is checked, the address is inside the last device at most */
+	while((address >= device->size) && (device != &g_devices[EEPROM_DEVICES_NUM - 1]))
+	{
+		address -= device->size;
+		device++;
+	}
+	*offset = address;
+	return device;
+}
+
+/*
+ * Description :
+ * Set up the TWI job of a memory location address and return the index of its device.
+ * The length is cut at the end of the page in a write and at the end of the device in a read.
+ */
+static uint8 EEPROM_setupJob(TWI_Job *job, uint8 *location, uint32 address, uint16 length, boolean read)
+{
+	uint32 offset;
+	const EEPROM_Device *device = EEPROM_findDevice(address, &offset);
+	uint8 index = (uint8)(device - g_devices);
+
+	/* The address counter rolls over inside the page while writing, stop at its end.
+	 * A sequential read goes on into the next pages and blocks, up to the end of the device. */
+	if(!read)
+	{
+		if(length > (device->page_size - (offset % device->page_size)))
+			length = device->page_size - (offset % device->page_size);
+	}
+	else if(length > (device->size - offset))
+	{
+		length = device->size - offset;
+	}
+
+	if(device->address_bytes == 1)
+	{
+		/* The device address carries the address bits above 8 (A8 A9 A10 of a 24C16) */
+		location[1] = (uint8)offset;
+		job->sla = (uint8)(device->sla | ((offset >> 7) & 0x0E));
+		job->header = &location[1];
+		job->header_length = 1;
+	}
+	else
+	{
+		location[0] = (uint8)(offset >> 8);
+		location[1] = (uint8)offset;
+		job->sla = device->sla;
+		job->header = location;
+		job->header_length = 2;
+	}
+	job->length = length;
+	job->read = read;
+	job->chain = NULL_PTR;
+	/* A NACK is expected only while a write cycle runs, it may also belong to a job queued before this one */
+	job->poll_tries = ((g_writeBusy & (1 << index)) || TWI_isBusy()) ? EEPROM_POLL_MAX_TRIES : 0;
+	return index;
+}
+
+/*
+ * Description :
+ * Queue the TWI job of the next page of a write, or of the read inside one device.
+ */
+static void EEPROM_submitJob(EEPROM_Request *request)
+{
+	TWI_Job *job = &request->job;
+
+	request->device = EEPROM_setupJob(job, request->location, request->address, request->remaining,
+									  (request->rx_data != NULL_PTR));
+	job->tx_data = request->tx_data;
+	job->rx_data = request->rx_data;
+	TWI_submit(job);
+}
+
+/*
+ * Description :
+ * TWI job callback: queue the next page or end the request.
+ */
+static void EEPROM_onJobDone(TWI_Job *job)
+{
+	EEPROM_Request *request = job->context;
+
+	if(job->status != TWI_JOB_DONE)
+	{
+		request->status = ERROR;
+	}
+	else
+	{
+		/* The stop of a write job starts the write cycle, the device acknowledged a read so no cycle runs */
+		if(job->read)
+			g_writeBusy &= ~(1 << request->device);
+		else
+			g_writeBusy |= 1 << request->device;
+		request->address += job->length;
+		request->remaining -= job->length;
+		if(request->tx_data != NULL_PTR)
+			request->tx_data += job->length;
+		if(request->rx_data != NULL_PTR)
+			request->rx_data += job->length;
+
+		if(request->remaining != 0)
+		{
+			EEPROM_submitJob(request);
+			return;
+		}
+		request->status = SUCCESS;
+	}
+	if(request->callback != NULL_PTR)
+		request->callback(request);
+}
+
+/*
+ * Description :
+ * Wait until a request started by a blocking function ends and return its status.
+ */
+static uint8 EEPROM_wait(EEPROM_Request *request)
+{
+	/* The jobs run from the TWI interrupt, a stuck bus ends the request with ERROR */
+	while(request->status == EEPROM_PENDING)
+	{
+		TWI_task();
+	}
+	return request->status;
+}
+
+/*
+ * Description :
+ * Copy the cached bytes not stored yet over the bytes read from the device.
+ */
+static void EEPROM_cacheOverlay(uint32 u32addr, uint8 *data, uint16 len)
+{
+	uint8 index, offset;
+	uint32 position;
+	EEPROM_CachePage *cache;
+
+	for(index = 0; index < EEPROM_CACHE_PAGES; index++)
+	{
+		cache = &g_cache[index];
+		for(offset = 0; (cache->dirty != 0) && (offset < EEPROM_PAGE_SIZE); offset++)
+		{
+			position = cache->page + offset;
+			if((cache->dirty & ((uint16)1 << offset)) && (position >= u32addr) && (position < u32addr + len))
+				data[position - u32addr] = cache->data[offset];
+		}
+	}
+}
+
+/*
+ * Description :
+ * A direct write is newer than the cached bytes of its range, take its bytes in the cache.
+ */
+static void EEPROM_cacheOverride(uint32 u32addr, const uint8 *data, uint16 len)
+{
+	uint8 index, offset;
+	uint32 position;
+	EEPROM_CachePage *cache;
+
+	for(index = 0; index < EEPROM_CACHE_PAGES; index++)
+	{
+		cache = &g_cache[index];
+		for(offset = 0; (cache->dirty != 0) && (offset < EEPROM_PAGE_SIZE); offset++)
+		{
+			position = cache->page + offset;
+			if((position >= u32addr) && (position < u32addr + len))
+			{
+				/* The direct write is queued after a cached write of the byte, so it is stored last */
+				cache->data[offset] = data[position - u32addr];
+				cache->dirty &= ~((uint16)1 << offset);
+				cache->writing &= ~((uint16)1 << offset);
+			}
+		}
+	}
+}
+
+/*
+ * Description :
+ * Return the cached page of an address, a free or the oldest one is taken for a new page.
+ * Return NULL_PTR if the oldest page can't be stored to free it.
+ */
+static EEPROM_CachePage *EEPROM_cachePage(uint32 page)
+{
+	uint8 index;
+	EEPROM_CachePage *cache, *oldest = &g_cache[0];
+
+	for(index = 0; index < EEPROM_CACHE_PAGES; index++)
+	{
+		if(g_cache[index].page == page)
+			return &g_cache[index];
+	}
+	for(index = 0; index < EEPROM_CACHE_PAGES; index++)
+	{
+		cache = &g_cache[index];
+		EEPROM_endPageWrite(cache);
+		if(cache->dirty == 0)
+		{
+			oldest = cache;
+			break;
+		}
+		if((sint32)(cache->first_change - oldest->first_change) < 0)
+			oldest = cache;
+	}
+	/* The only stall of the cache: every page is dirty, the oldest one is stored now and tried once more if it fails */
+	for(index = 0; (index < 2) && (oldest->dirty != 0); index++)
+	{
+		EEPROM_flushPage(oldest, TRUE);
+		EEPROM_wait(&oldest->request);
+		EEPROM_endPageWrite(oldest);
+	}
+	if(oldest->dirty != 0)
+		return NULL_PTR;
+	oldest->page = page;
+	return oldest;
+}
+
+/*
+ * Description :
+ * Start the write of the dirty bytes of a cached page in the background.
+ * If wait is FALSE nothing is done while the last write of the page is still running.
+ */
+static uint8 EEPROM_flushPage(EEPROM_CachePage *cache, boolean wait)
+{
+	uint8 first = 0, last = EEPROM_PAGE_SIZE - 1, offset;
+
+	if(cache->request.status == EEPROM_PENDING)
+	{
+		if(!wait)
+			return SUCCESS;
+		EEPROM_wait(&cache->request);
+	}
+	EEPROM_endPageWrite(cache);
+	if(cache->dirty == 0)
+		return SUCCESS;
+
+	/* One page write from the first dirty byte to the last one */
+	while(!(cache->dirty & ((uint16)1 << first)))
+		first++;
+	while(!(cache->dirty & ((uint16)1 << last)))
+		last--;
+	/* The unknown bytes between them are read first, the page may hold data of a direct write */
+	if(cache->dirty != (uint16)((((uint32)1 << (last + 1)) - 1) & ~(((uint16)1 << first) - 1)))
+	{
+		if(EEPROM_readBlock(cache->page + first, &cache->out[first], last - first + 1) != SUCCESS)
+			return ERROR;
+	}
+	for(offset = first; offset <= last; offset++)
+	{
+		if(cache->dirty & ((uint16)1 << offset))
+			cache->out[offset] = cache->data[offset];
+	}
+	/* The RAM page takes new changes at once, the write uses its own copy */
+	if(EEPROM_startRequest(&cache->request, cache->page + first, &cache->out[first], NULL_PTR,
+						   last - first + 1, NULL_PTR) != SUCCESS)
+		return ERROR;
+	/* The bytes sent stay dirty until the write succeeds */
+	cache->writing = cache->dirty;
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Check the last write of a cached page once it is done: the bytes it sent are clean
+ * if it succeeded and stay dirty for the next write if it failed.
+ */
+static void EEPROM_endPageWrite(EEPROM_CachePage *cache)
+{
+	if((cache->writing == 0) || (cache->request.status == EEPROM_PENDING))
+		return;
+	if(cache->request.status == SUCCESS)
+	{
+		cache->dirty &= ~cache->writing;
+	}
+	else
+	{
+		/* The failed bytes are tried again once the page is idle, not at once past the deadline */
+		cache->first_change = TICK_getMs();
+		cache->last_change = cache->first_change;
+	}
+	cache->writing = 0;
 }
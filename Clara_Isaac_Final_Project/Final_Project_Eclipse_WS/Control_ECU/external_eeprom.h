@@ -15,18 +15,180 @@
 #define EXTERNAL_EEPROM_H_
 
 #include "std_types.h"
+#include "twi.h"
 
 /*******************************************************************************
  *                      Preprocessor Macros                                    *
  *******************************************************************************/
 #define ERROR 0
 #define SUCCESS 1
+#define EEPROM_PENDING 2 /* status of a request still running in the background */
+
+/*
+ * Devices behind one linear address space, in the order of their addresses:
+ * DEVICE(device address, address bytes, page size, size)
+ * 1 address byte: 24C01 - 24C16, the address bits above 8 go in the device address
+ *                 (a 24C16 takes all the addresses 0xA0 - 0xAE, it is alone on the bus).
+ * 2 address bytes: 24C32 - 24C512, each one on its own A0 - A2 pins.
+ * Example, 2 x 24C256: DEVICE(0xA0, 2, 64, 32768UL) DEVICE(0xA2, 2, 64, 32768UL)
+ */
+#ifndef EEPROM_DEVICES
+#define EEPROM_DEVICES(DEVICE) \
+	DEVICE(0xA0, 1, 16, 2048UL) /* 24C16: 8 blocks of 256 bytes */
+#endif
+#define EEPROM_DEVICE_SIZE(sla, address_bytes, page_size, size) + (size)
+#define EEPROM_SIZE (0 EEPROM_DEVICES(EEPROM_DEVICE_SIZE))
+
+/* Page unit of the modules (store, audit log, user table), every device page is a multiple of it */
+#define EEPROM_PAGE_SIZE 16
+
+/* Worst case time of one internal write cycle */
+#define EEPROM_WRITE_CYCLE_MS 10
+
+/* SLA+W attempts while a write cycle runs, one attempt is about 30 us at 400 kHz
+ * so this is about 3 times the worst case write cycle */
+#define EEPROM_POLL_MAX_TRIES 1000
+
+/* TWI jobs of one EEPROM_readSegments transaction, a segment across 2 devices takes 2 jobs */
+#define EEPROM_SEGMENT_MAX_JOBS 4
+
+/*
+ * Write-behind cache: the bytes of EEPROM_writeCached are merged in RAM pages and a page is written
+ * once it was not changed for EEPROM_CACHE_IDLE_MS, at the latest EEPROM_CACHE_DEADLINE_MS after
+ * its first change, when its RAM page is needed for another page or by EEPROM_flush.
+ * A failed page write is tried again after EEPROM_CACHE_IDLE_MS.
+ */
+#define EEPROM_CACHE_PAGES 2
+#define EEPROM_CACHE_IDLE_MS 100UL
+#define EEPROM_CACHE_DEADLINE_MS 1000UL
+
+/*******************************************************************************
+ *                       Types Declaration                                     *
+ *******************************************************************************/
+
+/* A block read or write running in the background on the TWI job queue */
+typedef struct EEPROM_Request{
+ TWI_Job job; /* the TWI job of the current page */
+ uint8 location[2]; /* memory location address sent in the header of the job, high byte first */
+ uint32 address; /* next memory location of the request, in the linear address space */
+ uint8 device; /* index of the device of the current job */
+ const uint8 *tx_data; /* next bytes to write, NULL_PTR in a read */
+ uint8 *rx_data; /* next bytes to read, NULL_PTR in a write */
+ uint16 remaining;
+ void (*callback)(struct EEPROM_Request *request); /* called from the TWI ISR at the end, NULL for none */
+ volatile uint8 status; /* EEPROM_PENDING, then SUCCESS or ERROR */
+}EEPROM_Request;
+
+/* A device of the address map */
+typedef struct{
+ uint8 sla; /* device address with the R/W bit 0 */
+ uint8 address_bytes; /* 1 or 2 */
+ uint8 page_size;
+ uint32 size;
+}EEPROM_Device;
+
+/* A range of EEPROM_readSegments */
+typedef struct{
+ uint32 address;
+ uint8 *data;
+ uint16 len;
+}EEPROM_Segment;
+
+/* A page of the write-behind cache */
+typedef struct{
+ uint32 page; /* address of the page */
+ uint16 dirty; /* one bit per byte not stored in the device yet */
+ uint16 writing; /* dirty bytes sent by the page write running, they are clean once it succeeds */
+ uint32 first_change; /* time of the first change since the page was clean */
+ uint32 last_change;
+ uint8 data[EEPROM_PAGE_SIZE]; /* the written bytes, the others are unknown */
+ uint8 out[EEPROM_PAGE_SIZE]; /* bytes of the page write running in the background */
+ EEPROM_Request request;
+}EEPROM_CachePage;
 
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
 
-uint8 EEPROM_writeByte(uint16 u16addr,uint8 u8data);
-uint8 EEPROM_readByte(uint16 u16addr,uint8 *u8data);
+/*
+ * Description :
+ * Write one byte, the function returns once the write cycle has started.
+ * The next access waits for the end of the cycle by acknowledge polling.
+ */
+uint8 EEPROM_writeByte(uint32 u32addr,uint8 u8data);
+
+/*
+ * Description :
+ * Read one byte, it waits only if a write cycle is still running.
+ */
+uint8 EEPROM_readByte(uint32 u32addr,uint8 *u8data);
+
+/*
+ * Description :
+ * Write len bytes from u32addr, split on the page boundaries of the devices so each page
+ * is written by one start / address / data burst / stop sequence and one write cycle.
+ * It returns after the write cycle of the last page has started, the pages before it
+ * are waited by acknowledge polling.
+ */
+uint8 EEPROM_writeBlock(uint32 u32addr, const uint8 *data, uint16 len);
+
+/*
+ * Description :
+ * Read len bytes from u32addr with one addressing phase per device (sequential read),
+ * every byte is acknowledged except the last one.
+ */
+uint8 EEPROM_readBlock(uint32 u32addr, uint8 *data, uint16 len);
+
+/*
+ * Description :
+ * Read several ranges in one TWI transaction: the addressing phase and the read of each
+ * range follow the previous one with a repeated start, the stop is sent after the last one.
+ * Return ERROR if a range is wrong, the ranges take more than EEPROM_SEGMENT_MAX_JOBS jobs
+ * or a read fails.
+ */
+uint8 EEPROM_readSegments(const EEPROM_Segment *segments, uint8 count);
+
+/*
+ * Description :
+ * Start EEPROM_writeBlock in the background and return at once. The data must stay
+ * unchanged until request->status leaves EEPROM_PENDING, then the callback is called.
+ * Return ERROR if the range is wrong or the request is still pending.
+ */
+uint8 EEPROM_writeBlockAsync(EEPROM_Request *request, uint32 u32addr, const uint8 *data, uint16 len,
+							 void (*callback)(EEPROM_Request *request));
+
+/*
+ * Description :
+ * Start EEPROM_readBlock in the background and return at once,
+ * data is valid when request->status is SUCCESS.
+ * Return ERROR if the range is wrong or the request is still pending.
+ */
+uint8 EEPROM_readBlockAsync(EEPROM_Request *request, uint32 u32addr, uint8 *data, uint16 len,
+							void (*callback)(EEPROM_Request *request));
+
+/*
+ * Description :
+ * Write len bytes through the write-behind cache and return at once, repeated writes to
+ * the same page are merged into one page write. It waits only when no RAM page is free:
+ * the oldest one is written first. EEPROM_readByte, EEPROM_readBlock and EEPROM_readSegments
+ * see the cached bytes, EEPROM_readBlockAsync reads the device only.
+ * Return ERROR if the range is wrong or no RAM page could be freed.
+ */
+uint8 EEPROM_writeCached(uint32 u32addr, const uint8 *data, uint16 len);
+
+/*
+ * Description :
+ * Start the write of the cached pages that are idle or past their deadline.
+ * It must be called periodically.
+ */
+void EEPROM_task(void);
+
+/*
+ * Description :
+ * Write all the cached pages and wait until they are stored,
+ * return ERROR if one of them is still not stored.
+ */
+uint8 EEPROM_flush(void);
+
  
 #endif /* EXTERNAL_EEPROM_H_ */
@@ -0,0 +1,110 @@
+ /******************************************************************************
+ *
+ * Module: Internal EEPROM
+ *
+ * File Name: internal_eeprom.c
+ *
+ * Description: Source file for the on-chip EEPROM of the ATmega32
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "internal_eeprom.h"
+#include "common_macros.h"
+#include <avr/io.h>
+#include <avr/interrupt.h> /* For the EEPROM ready ISR */
+#include <string.h> /* To use memcpy function */
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Write running in the background, used by the ISR while g_remaining is not 0 */
+static uint8 g_buffer[IEEPROM_BUFFER_SIZE];
+static uint16 g_address;
+static uint8 g_index;
+static volatile uint8 g_remaining = 0;
+
+/*******************************************************************************
+ *                      Interrupt Service Routines                             *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * The last write cycle is over: start the next byte that changes,
+ * the interrupt is disabled after the last one.
+ */
+ISR(EE_RDY_vect)
+{
+	while(g_remaining != 0)
+	{
+		EEAR = g_address;
+		SET_BIT(EECR,EERE);
+		g_address++;
+		g_remaining--;
+		if(EEDR != g_buffer[g_index])
+		{
+			EEDR = g_buffer[g_index++];
+			/* EEWE must follow EEMWE within 4 cycles, the interrupts are already disabled here */
+			SET_BIT(EECR,EEMWE);
+			SET_BIT(EECR,EEWE);
+			return;
+		}
+		g_index++;
+	}
+	CLEAR_BIT(EECR,EERIE);
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Read len bytes from u16addr.
+ * Return ERROR if the range is wrong or a write is still running.
+ */
+uint8 IEEPROM_readBlock(uint16 u16addr, uint8 *data, uint16 len)
+{
+	/* The address register is used by the ISR until the last write cycle is over, the caller never spins here */
+	if((((uint32)u16addr + len) > IEEPROM_SIZE) || IEEPROM_isBusy())
+		return ERROR;
+
+	while(len != 0)
+	{
+		EEAR = u16addr++;
+		SET_BIT(EECR,EERE);
+		*data++ = EEDR;
+		len--;
+	}
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Copy len bytes and write them in the background, only the bytes that change
+ * cost a write cycle. Return ERROR if the range is wrong or the previous write is still running.
+ */
+uint8 IEEPROM_writeBlock(uint16 u16addr, const uint8 *data, uint8 len)
+{
+	if((len == 0) || (len > IEEPROM_BUFFER_SIZE) || (((uint32)u16addr + len) > IEEPROM_SIZE) || (g_remaining != 0))
+		return ERROR;
+
+	memcpy(g_buffer, data, len);
+	g_address = u16addr;
+	g_index = 0;
+	g_remaining = len;
+	/* The interrupt fires at once if no write cycle runs */
+	SET_BIT(EECR,EERIE);
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Return TRUE while a write is running.
+ */
+boolean IEEPROM_isBusy(void)
+{
+	return (g_remaining != 0) || BIT_IS_SET(EECR,EEWE);
+}
@@ -0,0 +1,60 @@
+ /******************************************************************************
+ *
+ * Module: Internal EEPROM
+ *
+ * File Name: internal_eeprom.h
+ *
+ * Description: Header file for the on-chip EEPROM of the ATmega32, the writes
+ *              run byte by byte from the EEPROM ready interrupt
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef INTERNAL_EEPROM_H_
+#define INTERNAL_EEPROM_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                      Preprocessor Macros                                    *
+ *******************************************************************************/
+
+#ifndef ERROR
+#define ERROR 0
+#endif
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+
+/* ATmega32: 1 KB, one write cycle of 8.5 ms per byte */
+#define IEEPROM_SIZE 1024
+
+/* Longest block written in the background, the bytes are copied */
+#define IEEPROM_BUFFER_SIZE 24
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Read len bytes from u16addr.
+ * Return ERROR if the range is wrong or a write is still running.
+ */
+uint8 IEEPROM_readBlock(uint16 u16addr, uint8 *data, uint16 len);
+
+/*
+ * Description :
+ * Copy len bytes and write them in the background, only the bytes that change
+ * cost a write cycle. Return ERROR if the range is wrong or the previous write is still running.
+ */
+uint8 IEEPROM_writeBlock(uint16 u16addr, const uint8 *data, uint8 len);
+
+/*
+ * Description :
+ * Return TRUE while a write is running.
+ */
+boolean IEEPROM_isBusy(void);
+
+#endif /* INTERNAL_EEPROM_H_ */
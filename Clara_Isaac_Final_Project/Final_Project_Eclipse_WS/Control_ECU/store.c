@@ -0,0 +1,428 @@
+ /******************************************************************************
+ *
+ * Module: Store
+ *
+ * File Name: store.c
+ *
+ * Description: Source file for the wear leveled record log in the external EEPROM
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "store.h"
+#include "crc.h"
+#include <string.h> /* To use memcpy and memset functions */
+
+#if ((STORE_FIRST_PAGE + STORE_PAGES_NUM) > (EEPROM_SIZE / EEPROM_PAGE_SIZE)) || (STORE_PAGES_NUM < 4) || \
+	((STORE_PAGES_NUM & 1) != 0)
+#error "The store needs an even number of pages (at least 2 slots) inside the EEPROM"
+#endif
+
+/* Record page */
+#define STORE_SEQ_OFFSET 0
+#define STORE_DATA_OFFSET 2
+#define STORE_CRC_OFFSET (STORE_RECORD_SIZE - 1)
+
+/* Commit page */
+#define STORE_COMMIT_SEQ_OFFSET 0
+#define STORE_COMMIT_NOT_SEQ_OFFSET 2
+#define STORE_COMMIT_RECORD_CRC_OFFSET 4
+#define STORE_COMMIT_CRC_OFFSET 5
+
+/* EEPROM addresses of the 2 pages of a slot */
+#define STORE_RECORD_ADDRESS(slot) ((uint32)(STORE_FIRST_PAGE + 2 * (slot)) * EEPROM_PAGE_SIZE)
+#define STORE_COMMIT_ADDRESS(slot) (STORE_RECORD_ADDRESS(slot) + EEPROM_PAGE_SIZE)
+
+/* A slot is read in one go from its record page to the end of the commit data */
+#define STORE_SLOT_READ_SIZE (STORE_RECORD_SIZE + STORE_COMMIT_SIZE)
+
+/* Mirror copy */
+#define STORE_MIRROR_SLOT_OFFSET STORE_RECORD_SIZE
+#define STORE_MIRROR_CRC_OFFSET (STORE_RECORD_SIZE + 1)
+#define STORE_MIRROR_COPY_ADDRESS(copy) (STORE_MIRROR_ADDRESS + (copy) * STORE_MIRROR_SIZE)
+
+#if ((STORE_MIRROR_ADDRESS + STORE_MIRROR_COPIES * STORE_MIRROR_SIZE) > IEEPROM_SIZE) || \
+	(STORE_MIRROR_SIZE > IEEPROM_BUFFER_SIZE)
+#error "The mirror copies don't fit in the internal EEPROM"
+#endif
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Head index: slot and sequence number of the newest record */
+static boolean g_hasRecord = FALSE;
+static uint8 g_headSlot = 0;
+static uint16 g_headSeq = 0;
+
+/* Slot being appended, it must not change before the writes are sent */
+static uint8 g_record[STORE_RECORD_SIZE];
+static uint8 g_commit[STORE_COMMIT_SIZE];
+static EEPROM_Request g_recordRequest;
+static EEPROM_Request g_commitRequest;
+
+/* Mirror copy waiting for the internal EEPROM, a newer one replaces it */
+static uint8 g_mirror[STORE_MIRROR_SIZE];
+static boolean g_mirrorPending = FALSE;
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Return the inverted CRC-8 of the first size bytes, as stored after them.
+ */
+static uint8 STORE_crc(const uint8 *data, uint8 size);
+
+/*
+ * Description:
+ * Read the record page of a slot, return TRUE if it holds a valid record.
+ */
+static boolean STORE_readRecord(uint8 slot, uint8 *record);
+
+/*
+ * Description:
+ * Return TRUE if a slot read (record page then commit data) holds a valid record
+ * and the commit page that belongs to it.
+ */
+static boolean STORE_isCommitted(const uint8 *slot_data);
+
+/*
+ * Description:
+ * Wait for the writes of the last append, return ERROR if one of them failed.
+ */
+static uint8 STORE_wait(void);
+
+/*
+ * Description:
+ * Return the sequence number of a record page.
+ */
+static uint16 STORE_seq(const uint8 *record);
+
+/*
+ * Description:
+ * Read the mirror copy of a slot, return FALSE if it is not valid.
+ */
+static boolean STORE_readMirrorCopy(uint8 slot, uint8 *record);
+
+/*
+ * Description:
+ * Read the newest valid copy of the mirror, return FALSE if there is none.
+ */
+static boolean STORE_readMirror(uint8 *record, uint8 *slot);
+
+/*
+ * Description:
+ * Queue the record of a slot for its copy of the mirror, STORE_task writes it.
+ */
+static void STORE_writeMirror(const uint8 *record, uint8 slot);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Find the newest committed record, from the mirror or by scanning the log once, and repair
+ * the copy that is behind. Return FALSE if there is none (blank EEPROMs).
+ * The extra ranges of the other modules are read too, in the same TWI transaction as the
+ * slots named by the mirror in the usual boot, extra_status is the result of their read.
+ */
+boolean STORE_init(const EEPROM_Segment *extra, uint8 extra_count, uint8 *extra_status)
+{
+	uint8 slot, data[2][STORE_SLOT_READ_SIZE], record[STORE_RECORD_SIZE], mirror[STORE_RECORD_SIZE], mirror_slot;
+	boolean has_mirror = STORE_readMirror(mirror, &mirror_slot);
+	EEPROM_Segment segments[2 + STORE_INIT_MAX_EXTRA];
+	uint16 seq;
+
+	*extra_status = ERROR;
+	/*
+	 * The usual boot: the slot named by the mirror holds the same committed record and the slot
+	 * after it an older one, both slots and the extra ranges are read in one TWI transaction
+	 */
+	if(has_mirror && (mirror_slot < STORE_SLOTS_NUM) && (extra_count <= STORE_INIT_MAX_EXTRA))
+	{
+		slot = (mirror_slot + 1) % STORE_SLOTS_NUM;
+		segments[0].address = STORE_RECORD_ADDRESS(mirror_slot);
+		segments[0].data = data[0];
+		segments[0].len = STORE_SLOT_READ_SIZE;
+		segments[1].address = STORE_RECORD_ADDRESS(slot);
+		segments[1].data = data[1];
+		segments[1].len = STORE_SLOT_READ_SIZE;
+		memcpy(&segments[2], extra, extra_count * sizeof(EEPROM_Segment));
+		if(EEPROM_readSegments(segments, 2 + extra_count) == SUCCESS)
+			*extra_status = SUCCESS;
+		if((*extra_status == SUCCESS) && STORE_isCommitted(data[0]) && !memcmp(data[0], mirror, STORE_RECORD_SIZE))
+		{
+			g_hasRecord = TRUE;
+			g_headSlot = mirror_slot;
+			g_headSeq = STORE_seq(mirror);
+			/* An append committed in the log whose mirror write was cut is in the next slots */
+			while(STORE_isCommitted(data[1]) && (STORE_seq(data[1]) == (uint16)(g_headSeq + 1)))
+			{
+				g_headSlot = slot;
+				g_headSeq++;
+				memcpy(mirror, data[1], STORE_RECORD_SIZE);
+				slot = (slot + 1) % STORE_SLOTS_NUM;
+				if(EEPROM_readBlock(STORE_RECORD_ADDRESS(slot), data[1], STORE_SLOT_READ_SIZE) != SUCCESS)
+					break;
+			}
+			if(g_headSlot != mirror_slot)
+				STORE_writeMirror(mirror, g_headSlot);
+			return TRUE;
+		}
+	}
+
+	/* The scan of the log reads the extra ranges on their own */
+	if(*extra_status != SUCCESS)
+		*extra_status = EEPROM_readSegments(extra, extra_count);
+
+	g_hasRecord = FALSE;
+	for(slot = 0; slot < STORE_SLOTS_NUM; slot++)
+	{
+		if((EEPROM_readBlock(STORE_RECORD_ADDRESS(slot), data[0], STORE_SLOT_READ_SIZE) != SUCCESS) ||
+		   !STORE_isCommitted(data[0]))
+			continue;
+		seq = STORE_seq(data[0]);
+		/* The sequence number wraps around, newer means ahead by less than half the range */
+		if(!g_hasRecord || ((sint16)(seq - g_headSeq) > 0))
+		{
+			g_hasRecord = TRUE;
+			g_headSlot = slot;
+			g_headSeq = seq;
+		}
+	}
+
+	if(has_mirror && (!g_hasRecord || ((sint16)(STORE_seq(mirror) - g_headSeq) > 0)))
+	{
+		/* The log lost its newest records (a torn append or a new device), the mirror's record is appended again */
+		g_headSeq = STORE_seq(mirror);
+		if(STORE_append(&mirror[STORE_DATA_OFFSET], STORE_DATA_SIZE) != SUCCESS)
+		{
+			/* The record is read from the mirror until the next append */
+			g_hasRecord = TRUE;
+			g_headSlot = mirror_slot;
+		}
+	}
+	else if(g_hasRecord && STORE_readRecord(g_headSlot, record))
+	{
+		/* The mirror is blank, bad or older than the log */
+		STORE_writeMirror(record, g_headSlot);
+	}
+	return g_hasRecord;
+}
+
+/*
+ * Description:
+ * Copy the first len bytes of the newest record's data, return ERROR if there is none
+ * or it can't be read back.
+ */
+uint8 STORE_read(uint8 *data, uint8 len)
+{
+	uint8 record[STORE_RECORD_SIZE];
+
+	if(!g_hasRecord || (len > STORE_DATA_SIZE))
+		return ERROR;
+
+	/*
+	 * The mirror is read without a TWI transfer, the log is read if it is bad, behind
+	 * or being written, and the mirror is written again
+	 */
+	if(!STORE_readMirrorCopy(g_headSlot, record) || (STORE_seq(record) != g_headSeq))
+	{
+		/* The TWI queue runs in order, a newest record still being written is read after its write */
+		if(!STORE_readRecord(g_headSlot, record) || (STORE_seq(record) != g_headSeq))
+			return ERROR;
+		STORE_writeMirror(record, g_headSlot);
+	}
+	memcpy(data, &record[STORE_DATA_OFFSET], len);
+	return SUCCESS;
+}
+
+/*
+ * Description:
+ * Append a record after the newest one (the oldest slot is reused when the log is full).
+ * The record and commit pages are queued behind the other TWI jobs and the function waits
+ * for their write cycles, the mirror is written in the background. Return ERROR if the record
+ * is not committed, the newest record is still the previous one then.
+ */
+uint8 STORE_append(const uint8 *data, uint8 len)
+{
+	uint8 slot = 0;
+	uint16 seq = g_headSeq + 1;
+
+	if(len > STORE_DATA_SIZE)
+		return ERROR;
+
+	/* The newest slot is never overwritten, it stays current until the new commit page is written */
+	if(g_hasRecord)
+		slot = (g_headSlot + 1) % STORE_SLOTS_NUM;
+
+	g_record[STORE_SEQ_OFFSET] = (uint8)seq;
+	g_record[STORE_SEQ_OFFSET + 1] = (uint8)(seq >> 8);
+	memset(&g_record[STORE_DATA_OFFSET], 0xFF, STORE_DATA_SIZE);
+	memcpy(&g_record[STORE_DATA_OFFSET], data, len);
+	g_record[STORE_CRC_OFFSET] = STORE_crc(g_record, STORE_CRC_OFFSET);
+
+	g_commit[STORE_COMMIT_SEQ_OFFSET] = (uint8)seq;
+	g_commit[STORE_COMMIT_SEQ_OFFSET + 1] = (uint8)(seq >> 8);
+	g_commit[STORE_COMMIT_NOT_SEQ_OFFSET] = (uint8)~seq;
+	g_commit[STORE_COMMIT_NOT_SEQ_OFFSET + 1] = (uint8)(~seq >> 8);
+	g_commit[STORE_COMMIT_RECORD_CRC_OFFSET] = g_record[STORE_CRC_OFFSET];
+	g_commit[STORE_COMMIT_CRC_OFFSET] = STORE_crc(g_commit, STORE_COMMIT_CRC_OFFSET);
+
+	/*
+	 * 2 page writes in this order, the TWI queue keeps the order and the commit page
+	 * is sent only when the record page's write cycle is over (acknowledge polling)
+	 */
+	if(EEPROM_writeBlockAsync(&g_recordRequest, STORE_RECORD_ADDRESS(slot), g_record, STORE_RECORD_SIZE, NULL_PTR) != SUCCESS)
+		return ERROR;
+	if(EEPROM_writeBlockAsync(&g_commitRequest, STORE_COMMIT_ADDRESS(slot), g_commit, STORE_COMMIT_SIZE, NULL_PTR) != SUCCESS)
+	{
+		STORE_wait(); /* the record page is not committed, the slot is reused by the next append */
+		return ERROR;
+	}
+	/* A failed or torn write leaves an uncommitted slot, the scan of the next boot skips it */
+	if(STORE_wait() != SUCCESS)
+		return ERROR;
+
+	g_hasRecord = TRUE;
+	g_headSlot = slot;
+	g_headSeq = seq;
+	/*
+	 * The record is committed in the log, a mirror that is not written stays behind the head
+	 * and STORE_read reads the log and writes the mirror again
+	 */
+	STORE_writeMirror(g_record, slot);
+	return SUCCESS;
+}
+
+/*
+ * Description:
+ * Write the queued mirror copy once the internal EEPROM is free, it must be called periodically.
+ */
+void STORE_task(void)
+{
+	if(g_mirrorPending && !IEEPROM_isBusy() &&
+	   (IEEPROM_writeBlock(STORE_MIRROR_COPY_ADDRESS(g_mirror[STORE_MIRROR_SLOT_OFFSET]), g_mirror, STORE_MIRROR_SIZE) == SUCCESS))
+	{
+		g_mirrorPending = FALSE;
+	}
+}
+
+/*
+ * Description:
+ * Return the inverted CRC-8 of the first size bytes, as stored after them.
+ */
+static uint8 STORE_crc(const uint8 *data, uint8 size)
+{
+	return (uint8)(CRC_calculate8(data, size) ^ 0xFF);
+}
+
+/*
+ * Description:
+ * Read the record page of a slot, return TRUE if it holds a valid record.
+ */
+static boolean STORE_readRecord(uint8 slot, uint8 *record)
+{
+	if(EEPROM_readBlock(STORE_RECORD_ADDRESS(slot), record, STORE_RECORD_SIZE) != SUCCESS)
+		return FALSE;
+	return (record[STORE_CRC_OFFSET] == STORE_crc(record, STORE_CRC_OFFSET));
+}
+
+/*
+ * Description:
+ * Return TRUE if a slot read (record page then commit data) holds a valid record
+ * and the commit page that belongs to it.
+ */
+static boolean STORE_isCommitted(const uint8 *slot_data)
+{
+	const uint8 *record = slot_data, *commit = &slot_data[STORE_RECORD_SIZE];
+
+	return ((record[STORE_CRC_OFFSET] == STORE_crc(record, STORE_CRC_OFFSET)) &&
+			(commit[STORE_COMMIT_CRC_OFFSET] == STORE_crc(commit, STORE_COMMIT_CRC_OFFSET)) &&
+			(commit[STORE_COMMIT_SEQ_OFFSET] == record[STORE_SEQ_OFFSET]) &&
+			(commit[STORE_COMMIT_SEQ_OFFSET + 1] == record[STORE_SEQ_OFFSET + 1]) &&
+			((uint8)(commit[STORE_COMMIT_NOT_SEQ_OFFSET] ^ record[STORE_SEQ_OFFSET]) == 0xFF) &&
+			((uint8)(commit[STORE_COMMIT_NOT_SEQ_OFFSET + 1] ^ record[STORE_SEQ_OFFSET + 1]) == 0xFF) &&
+			(commit[STORE_COMMIT_RECORD_CRC_OFFSET] == record[STORE_CRC_OFFSET]));
+}
+
+/*
+ * Description:
+ * Wait for the writes of the last append, return ERROR if one of them failed.
+ */
+static uint8 STORE_wait(void)
+{
+	while((g_recordRequest.status == EEPROM_PENDING) || (g_commitRequest.status == EEPROM_PENDING))
+	{
+		TWI_task();
+	}
+	return ((g_recordRequest.status == SUCCESS) && (g_commitRequest.status == SUCCESS)) ? SUCCESS : ERROR;
+}
+
+/*
+ * Description:
+ * Return the sequence number of a record page.
+ */
+static uint16 STORE_seq(const uint8 *record)
+{
+	return record[STORE_SEQ_OFFSET] | ((uint16)record[STORE_SEQ_OFFSET + 1] << 8);
+}
+
+/*
+ * Description:
+ * Read the mirror copy of a slot, return FALSE if it is not valid.
+ */
+static boolean STORE_readMirrorCopy(uint8 slot, uint8 *record)
+{
+	uint8 mirror[STORE_MIRROR_SIZE];
+
+	/* A copy is not read while the internal EEPROM is written, the log is read instead */
+	if((IEEPROM_readBlock(STORE_MIRROR_COPY_ADDRESS(slot), mirror, STORE_MIRROR_SIZE) != SUCCESS) ||
+	   (mirror[STORE_MIRROR_CRC_OFFSET] != STORE_crc(mirror, STORE_MIRROR_CRC_OFFSET)) ||
+	   (mirror[STORE_CRC_OFFSET] != STORE_crc(mirror, STORE_CRC_OFFSET)) ||
+	   (mirror[STORE_MIRROR_SLOT_OFFSET] != slot))
+		return FALSE;
+	memcpy(record, mirror, STORE_RECORD_SIZE);
+	return TRUE;
+}
+
+/*
+ * Description:
+ * Read the newest valid copy of the mirror, return FALSE if there is none.
+ */
+static boolean STORE_readMirror(uint8 *record, uint8 *slot)
+{
+	uint8 copy, mirror[STORE_RECORD_SIZE];
+	boolean found = FALSE;
+
+	for(copy = 0; copy < STORE_MIRROR_COPIES; copy++)
+	{
+		if(!STORE_readMirrorCopy(copy, mirror))
+			continue;
+		if(!found || ((sint16)(STORE_seq(mirror) - STORE_seq(record)) > 0))
+		{
+			found = TRUE;
+			memcpy(record, mirror, STORE_RECORD_SIZE);
+			*slot = copy;
+		}
+	}
+	return found;
+}
+
+/*
+ * Description:
+ * Queue the record of a slot for its copy of the mirror, STORE_task writes it.
+ */
+static void STORE_writeMirror(const uint8 *record, uint8 slot)
+{
+	memcpy(g_mirror, record, STORE_RECORD_SIZE);
+	g_mirror[STORE_MIRROR_SLOT_OFFSET] = slot;
+	g_mirror[STORE_MIRROR_CRC_OFFSET] = STORE_crc(g_mirror, STORE_MIRROR_CRC_OFFSET);
+	/* Only the newest record matters, the other copies keep the older ones meanwhile */
+	g_mirrorPending = TRUE;
+	STORE_task();
+}
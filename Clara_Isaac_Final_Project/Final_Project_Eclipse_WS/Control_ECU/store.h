@@ -0,0 +1,97 @@
+ /******************************************************************************
+ *
+ * Module: Store
+ *
+ * File Name: store.h
+ *
+ * Description: Header file for the wear leveled record log in the external EEPROM.
+ *              Every update appends one slot with the next sequence number, the
+ *              newest committed slot is the current record. The newest record is
+ *              mirrored in the internal EEPROM, each copy repairs the other.
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef STORE_H_
+#define STORE_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+#include "internal_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Pages used by the log (an even number, 2 pages per slot), the first 512 bytes of the 24C16 */
+#ifndef STORE_FIRST_PAGE
+#define STORE_FIRST_PAGE 0
+#endif
+#ifndef STORE_PAGES_NUM
+#define STORE_PAGES_NUM 32
+#endif
+
+/*
+ * Slot = 2 pages, written in this order:
+ * Record page: sequence number (2 bytes, little endian) | data | inverted CRC-8 of the rest.
+ * Commit page: sequence number | inverted sequence number | CRC byte of the record page | inverted CRC-8 of the rest.
+ * The commit page is written only after the record page's write cycle is over, a slot torn by a power
+ * loss has no matching commit page and the previous slot stays the current record. The data is padded
+ * with 0xFF, the CRCs are inverted so a blank or cleared page is never valid.
+ */
+#define STORE_RECORD_SIZE EEPROM_PAGE_SIZE
+#define STORE_DATA_SIZE (STORE_RECORD_SIZE - 3)
+#define STORE_COMMIT_SIZE 6
+#define STORE_SLOTS_NUM (STORE_PAGES_NUM / 2)
+
+/*
+ * Mirror in the internal EEPROM: record page | slot of the record | inverted CRC-8 of the rest.
+ * Each slot of the log has its own copy, written with the slot, so a copy wears as fast as
+ * its slot and a torn write leaves the copies of the older slots. At boot the newest copy
+ * that matches its slot in the log saves the scan of the log.
+ */
+#ifndef STORE_MIRROR_ADDRESS
+#define STORE_MIRROR_ADDRESS 0
+#endif
+#define STORE_MIRROR_SIZE (STORE_RECORD_SIZE + 2)
+#define STORE_MIRROR_COPIES STORE_SLOTS_NUM
+
+/* Extra ranges read by STORE_init with the 2 slots of the usual boot */
+#define STORE_INIT_MAX_EXTRA 2
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Find the newest committed record, from the mirror or by scanning the log once, and repair
+ * the copy that is behind. Return FALSE if there is none (blank EEPROMs).
+ * The extra ranges of the other modules are read too, in the same TWI transaction as the
+ * slots named by the mirror in the usual boot, extra_status is the result of their read.
+ */
+boolean STORE_init(const EEPROM_Segment *extra, uint8 extra_count, uint8 *extra_status);
+
+/*
+ * Description:
+ * Copy the first len bytes of the newest record's data from the mirror, or from the log
+ * if the mirror is bad. Return ERROR if there is none or it can't be read back.
+ */
+uint8 STORE_read(uint8 *data, uint8 len);
+
+/*
+ * Description:
+ * Append a record after the newest one (the oldest slot is reused when the log is full).
+ * The function waits for the record and commit pages, the mirror is queued for STORE_task.
+ * Return ERROR if the record is not committed, the newest record is still the previous one then.
+ */
+uint8 STORE_append(const uint8 *data, uint8 len);
+
+/*
+ * Description:
+ * Write the queued mirror copy once the internal EEPROM is free, it must be called periodically.
+ */
+void STORE_task(void);
+
+#endif /* STORE_H_ */
@@ -0,0 +1,40 @@
+ /******************************************************************************
+ *
+ * Module: Tick
+ *
+ * File Name: tick.h
+ *
+ * Description: Header file for the 1 ms system tick based on Timer2
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef TICK_H_
+#define TICK_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Start Timer2 in CTC mode with an interrupt every 1 ms.
+ */
+void TICK_init(void);
+
+/*
+ * Description:
+ * Return the number of milliseconds since TICK_init.
+ */
+uint32 TICK_getMs(void);
+
+/*
+ * Description:
+ * Return the number of milliseconds passed since the given start time.
+ */
+uint32 TICK_elapsedMs(uint32 start);
+
+#endif /* TICK_H_ */
@@ -13,13 +13,193 @@
 #include "twi.h"
 #include "common_macros.h"
 #include <avr/io.h>
+#include "tick.h"
+#include <avr/interrupt.h> /* For the TWI ISR */
+#include <util/delay.h> /* For the SCL pulses of the bus recovery */
+
+/* TWCR values used by the interrupt driven engine */
+#define TWI_NEXT ((1 << TWINT) | (1 << TWEN) | (1 << TWIE)) /* send TWDR or receive without ACK */
+#define TWI_NEXT_ACK (TWI_NEXT | (1 << TWEA)) /* receive and send ACK */
+#define TWI_NEXT_START (TWI_NEXT | (1 << TWSTA)) /* send a (repeated) start */
+
+/*
+ * SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS), the smallest prescaler that keeps TWBR within 8 bits
+ * is used and TWBR is rounded up, so the bus is never faster than required
+ */
+#define TWI_DIVIDER(SCL) ((F_CPU) / (SCL) - 16UL) /* 2 * TWBR * 4^TWPS */
+#define TWI_TWPS(SCL) ((TWI_DIVIDER(SCL) <= 510UL) ? 0UL : (TWI_DIVIDER(SCL) <= 2040UL) ? 1UL : \
+					   (TWI_DIVIDER(SCL) <= 8160UL) ? 2UL : 3UL)
+#define TWI_TWBR(SCL) ((TWI_DIVIDER(SCL) + (2UL << (2 * TWI_TWPS(SCL))) - 1UL) / (2UL << (2 * TWI_TWPS(SCL))))
+
+/* Real SCL frequency generated by these TWBR and TWPS values */
+#define TWI_REAL_SCL(SCL) ((F_CPU) / (16UL + (TWI_TWBR(SCL) << (1 + 2 * TWI_TWPS(SCL)))))
+
+/* The master does not work reliably with a TWBR below 10 (ATmega32 data sheet) */
+#define TWI_MIN_TWBR 10UL
+
+/* TRUE if F_CPU can generate the frequency: TWBR fits in 8 bits, is not below the minimum
+ * and the clock is within 10% below it */
+#define TWI_SCL_IS_VALID(SCL) (((F_CPU) >= 16UL * (SCL)) && (TWI_TWBR(SCL) <= 255UL) && \
+							   (TWI_TWBR(SCL) >= TWI_MIN_TWBR) && \
+							   (TWI_REAL_SCL(SCL) <= (SCL)) && (TWI_REAL_SCL(SCL) * 10UL >= (SCL) * 9UL))
+
+/* Fast mode is 400 kHz, or the fastest SCL with the minimum TWBR if F_CPU is too slow for it
+ * (about 222 kHz at 8 MHz) */
+#if ((F_CPU) >= 16UL * 400000UL) && (TWI_TWBR(400000UL) >= TWI_MIN_TWBR)
+#define TWI_FAST_SCL 400000UL
+#else
+#define TWI_FAST_SCL ((F_CPU) / (16UL + 2UL * TWI_MIN_TWBR))
+#endif
+
+#if !TWI_SCL_IS_VALID(100000UL) || !TWI_SCL_IS_VALID(TWI_FAST_SCL)
+#error "A TWI SCL frequency is not reachable with this F_CPU"
+#endif
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* TWBR and TWPS values indexed by TWI_BaudRate, no division is done on the target */
+static const uint8 g_twbrTable[TWI_BAUD_RATES_NUM] = {
+	TWI_TWBR(100000UL), TWI_TWBR(TWI_FAST_SCL)
+};
+static const uint8 g_twpsTable[TWI_BAUD_RATES_NUM] = {
+	TWI_TWPS(100000UL), TWI_TWPS(TWI_FAST_SCL)
+};
+
+/* Job queue, the head is the running job */
+static TWI_Job *volatile g_head = NULL_PTR;
+static TWI_Job *g_tail = NULL_PTR;
+
+/* Progress of the running job, used by the ISR only */
+static uint8 g_headerIndex;
+static uint16 g_dataIndex;
+static uint16 g_pollTries;
+
+/* TRUE when the running job was started by the repeated start that ended the job before it */
+static boolean g_chained = FALSE;
+
+/* TRUE while a job callback runs, the queue is restarted after it */
+static boolean g_finishing = FALSE;
+
+/* The bus must be recovered by TWI_task before the queue goes on */
+static volatile boolean g_recoverPending = FALSE;
+
+/* Incremented by every TWI interrupt, TWI_task sees a stuck job when it stops changing */
+static volatile uint8 g_activity = 0;
+static uint8 g_seenActivity = 0;
+static uint32 g_activityTime = 0;
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * End the running job with the given status, call its callback and send the stop,
+ * followed by the start of the next job if any. The next job of the same transaction
+ * gets a repeated start without the stop.
+ */
+static void TWI_finish(TWI_JobStatus status);
+
+/*
+ * Description :
+ * Wait for the TWINT flag of a blocking step for at most TWI_TIMEOUT_MS,
+ * recover the bus on a timeout, a bus error or a lost arbitration.
+ */
+static void TWI_wait(void);
+
+/*******************************************************************************
+ *                       Interrupt Service Routines                            *
+ *******************************************************************************/
+
+ISR(TWI_vect)
+{
+	TWI_Job *job = g_head;
+
+	g_activity++;
+	switch(TWI_getStatus())
+	{
+	case TWI_REP_START:
+		if(!g_chained)
+		{
+			/* The read part of the running job */
+			TWDR = job->sla | 1;
+			TWCR = TWI_NEXT;
+			break;
+		}
+		/* The first start of a chained job, it goes on like after a start */
+		/* fall through */
+	case TWI_START:
+		g_chained = FALSE;
+		g_headerIndex = 0;
+		g_dataIndex = 0;
+		/* A read job without header starts reading at the current address */
+		TWDR = ((job->header_length == 0) && job->read) ? (job->sla | 1) : job->sla;
+		TWCR = TWI_NEXT;
+		break;
+	case TWI_MT_SLA_W_ACK:
+	case TWI_MT_DATA_ACK:
+		if(g_headerIndex < job->header_length)
+		{
+			TWDR = job->header[g_headerIndex++];
+			TWCR = TWI_NEXT;
+		}
+		else if(job->read)
+		{
+			TWCR = TWI_NEXT_START;
+		}
+		else if(g_dataIndex < job->length)
+		{
+			TWDR = job->tx_data[g_dataIndex++];
+			TWCR = TWI_NEXT;
+		}
+		else
+		{
+			TWI_finish(TWI_JOB_DONE);
+		}
+		break;
+	case TWI_MT_SLA_W_NACK:
+		/* The device is busy (EEPROM write cycle), stop and try again */
+		if(g_pollTries != 0)
+		{
+			g_pollTries--;
+			TWCR = TWI_NEXT_START | (1 << TWSTO);
+		}
+		else
+		{
+			TWI_finish(TWI_JOB_NACK);
+		}
+		break;
+	case TWI_MT_SLA_R_ACK:
+		/* The last byte is received without ACK */
+		TWCR = (job->length > 1) ? TWI_NEXT_ACK : TWI_NEXT;
+		break;
+	case TWI_MR_DATA_ACK:
+		job->rx_data[g_dataIndex++] = TWDR;
+		TWCR = ((g_dataIndex + 1) < job->length) ? TWI_NEXT_ACK : TWI_NEXT;
+		break;
+	case TWI_MR_DATA_NACK:
+		job->rx_data[g_dataIndex] = TWDR;
+		TWI_finish(TWI_JOB_DONE);
+		break;
+	case TWI_MT_DATA_NACK:
+	case TWI_MR_SLA_R_NACK:
+		TWI_finish(TWI_JOB_NACK);
+		break;
+	default:
+		/* Arbitration lost (a slave holds SDA low, there is no other master) or bus error */
+		g_recoverPending = TRUE;
+		TWI_finish(TWI_JOB_BUS_ERROR);
+		break;
+	}
+}
 
 void TWI_init(const TWI_ConfigType * Config_Ptr)
 {
-    /* TWBR = Bit rate */
-    TWBR = Config_Ptr->bit_rate;
-    /* Prescaler = 0*/
-	TWSR = 0x00;
+    /* TWBR and the prescaler (TWPS bits in TWSR) of the required SCL frequency */
+    TWBR = g_twbrTable[Config_Ptr->bit_rate];
+	TWSR = g_twpsTable[Config_Ptr->bit_rate];
 	
     /* Two Wire Bus address my address if any master device want to call me (used in case this MC is a slave device)
        General Call Recognition: Off */
@@ -30,6 +210,12 @@ void TWI_init(const TWI_ConfigType * Config_Ptr)
 
 void TWI_start(void)
 {
+    /* The queued jobs own the bus until they are done */
+    while(TWI_isBusy())
+    {
+    	TWI_task();
+    }
+
     /* 
 	 * Clear the TWINT flag before sending the start bit TWINT=1
 	 * send the start bit by TWSTA=1
@@ -38,7 +224,7 @@ void TWI_start(void)
     TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
     
     /* Wait for TWINT flag set in TWCR Register (start bit is send successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_wait();
 }
 
 void TWI_stop(void)
@@ -61,7 +247,7 @@ void TWI_writeByte(uint8 data)
 	 */ 
     TWCR = (1 << TWINT) | (1 << TWEN);
     /* Wait for TWINT flag set in TWCR Register(data is send successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_wait();
 }
 
 uint8 TWI_readByteWithACK(void)
@@ -73,7 +259,7 @@ uint8 TWI_readByteWithACK(void)
 	 */ 
     TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWEA);
     /* Wait for TWINT flag set in TWCR Register (data received successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_wait();
     /* Read Data */
     return TWDR;
 }
@@ -86,7 +272,7 @@ uint8 TWI_readByteWithNACK(void)
 	 */
     TWCR = (1 << TWINT) | (1 << TWEN);
     /* Wait for TWINT flag set in TWCR Register (data received successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_wait();
     /* Read Data */
     return TWDR;
 }
@@ -98,3 +284,226 @@ uint8 TWI_getStatus(void)
     status = TWSR & 0xF8;
     return status;
 }
+
+/*
+ * Description :
+ * Queue a job, it runs in the background from the TWI interrupt after the jobs queued before it.
+ * A job queued from a job callback runs right after that job.
+ * The jobs chained to it are queued with it, in order.
+ * Return FALSE if a job is still queued or a read job has no data.
+ */
+boolean TWI_submit(TWI_Job *job)
+{
+	uint8 sreg;
+	TWI_Job *last;
+
+	for(last = job; ; last = last->chain)
+	{
+		if((last->status == TWI_JOB_QUEUED) || (last->read && (last->length == 0)))
+			return FALSE;
+		if(last->chain == NULL_PTR)
+			break;
+	}
+
+	/* The queue is shared with the ISR */
+	sreg = SREG;
+	cli();
+	/* A transaction takes consecutive places in the queue */
+	for(last = job; last->chain != NULL_PTR; last = last->chain)
+	{
+		last->status = TWI_JOB_QUEUED;
+		last->next = last->chain;
+	}
+	last->status = TWI_JOB_QUEUED;
+	if(g_finishing)
+	{
+		/* A job queued by a callback continues the same transfer, it runs next (the stop and start follow the callback) */
+		last->next = g_head;
+		if(g_head == NULL_PTR)
+			g_tail = last;
+		g_head = job;
+		g_pollTries = job->poll_tries;
+	}
+	else
+	{
+		last->next = NULL_PTR;
+		if(g_head == NULL_PTR)
+		{
+			g_head = job;
+			g_pollTries = job->poll_tries;
+			g_seenActivity = g_activity;
+			g_activityTime = TICK_getMs();
+			/* Start now, after the stop of the last job if it is still being sent (TWI_task starts it after a recovery) */
+			if(!g_recoverPending)
+				TWCR = TWI_NEXT_START | (TWCR & (1 << TWSTO));
+		}
+		else
+		{
+			g_tail->next = job;
+		}
+		g_tail = last;
+	}
+	SREG = sreg;
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Return TRUE while a job is queued or running.
+ */
+boolean TWI_isBusy(void)
+{
+	return (g_head != NULL_PTR);
+}
+
+/*
+ * Description :
+ * End the running job with the given status, call its callback and send the stop,
+ * followed by the start of the next job if any. The next job of the same transaction
+ * gets a repeated start without the stop.
+ */
+static void TWI_finish(TWI_JobStatus status)
+{
+	TWI_Job *job = g_head;
+
+	g_head = job->next;
+	if(g_head != NULL_PTR)
+		g_pollTries = g_head->poll_tries;
+
+	job->status = status;
+	if(job->callback != NULL_PTR)
+	{
+		g_finishing = TRUE;
+		job->callback(job);
+		g_finishing = FALSE;
+	}
+
+	/* The bus is kept for the rest of the transaction, otherwise the stop and the next start are sent in one go */
+	if((status == TWI_JOB_DONE) && (g_head != NULL_PTR) && (g_head == job->chain) && !g_recoverPending)
+	{
+		g_chained = TRUE;
+		TWCR = TWI_NEXT_START;
+	}
+	else if((g_head != NULL_PTR) && !g_recoverPending)
+		TWCR = TWI_NEXT_START | (1 << TWSTO);
+	else
+		TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+}
+
+/*
+ * Description :
+ * Watch the running job, it must be called periodically (and while waiting for a job).
+ * A job without any TWI interrupt for TWI_TIMEOUT_MS, or one ended by a bus error or a lost
+ * arbitration, is ended with its status, the bus is recovered and the queue goes on.
+ */
+void TWI_task(void)
+{
+	uint8 sreg;
+
+	if(!g_recoverPending)
+	{
+		if(g_head == NULL_PTR)
+			return;
+		if(g_activity != g_seenActivity)
+		{
+			g_seenActivity = g_activity;
+			g_activityTime = TICK_getMs();
+			return;
+		}
+		if(TICK_elapsedMs(g_activityTime) <= TWI_TIMEOUT_MS)
+			return;
+
+		/* No interrupt for TWI_TIMEOUT_MS, check again with the ISR blocked */
+		sreg = SREG;
+		cli();
+		if((g_head == NULL_PTR) || (g_activity != g_seenActivity))
+		{
+			SREG = sreg;
+			return;
+		}
+		g_recoverPending = TRUE;
+		TWI_finish(TWI_JOB_TIMEOUT);
+		SREG = sreg;
+	}
+
+	TWI_recoverBus();
+
+	sreg = SREG;
+	cli();
+	g_recoverPending = FALSE;
+	g_chained = FALSE;
+	if(g_head != NULL_PTR)
+	{
+		g_pollTries = g_head->poll_tries;
+		g_seenActivity = g_activity;
+		g_activityTime = TICK_getMs();
+		TWCR = TWI_NEXT_START;
+	}
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Free a bus held by a slave: disconnect the TWI, clock SCL up to 9 times until the slave
+ * releases SDA, send a stop condition by hand and enable the TWI again with the same bit rate.
+ */
+void TWI_recoverBus(void)
+{
+	uint8 i;
+
+	/* Disconnect the TWI from the pins */
+	TWCR = 0;
+
+	/* Open drain: a pin is pulled low as an output at 0 and released (pulled up) as an input */
+	GPIO_setupPinDirection(TWI_PORT_ID, TWI_SCL_PIN_ID, PIN_INPUT);
+	GPIO_setupPinDirection(TWI_PORT_ID, TWI_SDA_PIN_ID, PIN_INPUT);
+	GPIO_writePin(TWI_PORT_ID, TWI_SCL_PIN_ID, LOGIC_LOW);
+	GPIO_writePin(TWI_PORT_ID, TWI_SDA_PIN_ID, LOGIC_LOW);
+
+	/* Every clock lets the slave shift out one more bit of the byte it is stuck in */
+	for(i = 0; (i < 9) && (GPIO_readPin(TWI_PORT_ID, TWI_SDA_PIN_ID) == LOGIC_LOW); i++)
+	{
+		GPIO_setupPinDirection(TWI_PORT_ID, TWI_SCL_PIN_ID, PIN_OUTPUT);
+		_delay_us(5);
+		GPIO_setupPinDirection(TWI_PORT_ID, TWI_SCL_PIN_ID, PIN_INPUT);
+		_delay_us(5);
+	}
+
+	/* Stop condition: SDA rises while SCL is high */
+	GPIO_setupPinDirection(TWI_PORT_ID, TWI_SCL_PIN_ID, PIN_OUTPUT);
+	_delay_us(5);
+	GPIO_setupPinDirection(TWI_PORT_ID, TWI_SDA_PIN_ID, PIN_OUTPUT);
+	_delay_us(5);
+	GPIO_setupPinDirection(TWI_PORT_ID, TWI_SCL_PIN_ID, PIN_INPUT);
+	_delay_us(5);
+	GPIO_setupPinDirection(TWI_PORT_ID, TWI_SDA_PIN_ID, PIN_INPUT);
+	_delay_us(5);
+
+	/* TWBR and TWSR still hold the bit rate */
+	TWCR = (1 << TWEN);
+}
+
+/*
+ * Description :
+ * Wait for the TWINT flag of a blocking step for at most TWI_TIMEOUT_MS,
+ * recover the bus on a timeout, a bus error or a lost arbitration.
+ */
+static void TWI_wait(void)
+{
+	uint32 start = TICK_getMs();
+	uint8 status;
+
+	while(BIT_IS_CLEAR(TWCR,TWINT))
+	{
+		if(TICK_elapsedMs(start) > TWI_TIMEOUT_MS)
+		{
+			/* TWSR reads TWI_NO_STATE after the recovery, the step fails */
+			TWI_recoverBus();
+			return;
+		}
+	}
+
+	status = TWI_getStatus();
+	if((status == TWI_BUS_ERROR) || (status == TWI_ARB_LOST))
+		TWI_recoverBus();
+}
@@ -14,6 +14,7 @@
 #define TWI_H_
 
 #include "std_types.h"
+#include "gpio.h"
 
 /*******************************************************************************
  *                      Preprocessor Macros                                    *
@@ -23,10 +24,27 @@
 #define TWI_START         0x08 /* start has been sent */
 #define TWI_REP_START     0x10 /* repeated start */
 #define TWI_MT_SLA_W_ACK  0x18 /* Master transmit ( slave address + Write request ) to slave + ACK received from slave. */
+#define TWI_MT_SLA_W_NACK 0x20 /* Master transmit ( slave address + Write request ) to slave + NACK received from slave. */
 #define TWI_MT_SLA_R_ACK  0x40 /* Master transmit ( slave address + Read request ) to slave + ACK received from slave. */
 #define TWI_MT_DATA_ACK   0x28 /* Master transmit data and ACK has been received from Slave. */
+#define TWI_MT_DATA_NACK  0x30 /* Master transmit data and NACK has been received from Slave. */
+#define TWI_ARB_LOST      0x38 /* Arbitration lost to another master. */
+#define TWI_MR_SLA_R_NACK 0x48 /* Master transmit ( slave address + Read request ) to slave + NACK received from slave. */
 #define TWI_MR_DATA_ACK   0x50 /* Master received data and send ACK to slave. */
 #define TWI_MR_DATA_NACK  0x58 /* Master received data but doesn't send ACK to slave. */
+#define TWI_BUS_ERROR     0x00 /* Illegal start or stop condition on the bus. */
+#define TWI_NO_STATE      0xF8 /* No TWI action, also read after a timed out step. */
+
+/* Number of TWI_BaudRate values */
+#define TWI_BAUD_RATES_NUM 2
+
+/* A TWI step (or a running job) that shows no progress for this time means the bus is stuck */
+#define TWI_TIMEOUT_MS 5
+
+/* TWI pins, driven as GPIOs by the bus recovery */
+#define TWI_PORT_ID PORTC_ID
+#define TWI_SCL_PIN_ID PIN0_ID
+#define TWI_SDA_PIN_ID PIN1_ID
 
 /*******************************************************************************
  *                       Types Declaration                                     *
@@ -34,17 +52,56 @@
 
 typedef uint8 TWI_Address;
 
-typedef uint8 TWI_BaudRate;
+/* SCL frequencies, TWBR and the prescaler of each one are calculated for F_CPU at compile time */
+typedef enum{
+	TWI_STANDARD_MODE, /* 100 kHz */
+	TWI_FAST_MODE /* 400 kHz (the 24C16 supports it from 2.5 V), clamped to TWBR = 10 if F_CPU is
+					 below 14.4 MHz: about 222 kHz at 8 MHz */
+}TWI_BaudRate;
 
 typedef struct{
  TWI_Address address;
  TWI_BaudRate bit_rate;
 }TWI_ConfigType;
 
+typedef enum{
+	TWI_JOB_IDLE, TWI_JOB_QUEUED, TWI_JOB_DONE, TWI_JOB_NACK, TWI_JOB_BUS_ERROR, TWI_JOB_TIMEOUT
+}TWI_JobStatus;
+
+/*
+ * One transfer of the interrupt driven engine: start, SLA+W, header, then either the
+ * written data and stop, or a repeated start, SLA+R, the read data and stop.
+ * The job belongs to the engine from TWI_submit until its status leaves TWI_JOB_QUEUED.
+ * Jobs linked by chain make one transaction: each one follows the previous one with a
+ * repeated start, the bus is held from the first start to the stop after the last job.
+ */
+typedef struct TWI_Job{
+ uint8 sla; /* device address with R/W = 0 */
+ const uint8 *header; /* written first, like the memory location address, may be empty */
+ uint8 header_length;
+ const uint8 *tx_data; /* written after the header in a write job */
+ uint8 *rx_data; /* filled after the repeated start in a read job */
+ uint16 length; /* bytes written or read after the header, not 0 in a read job */
+ boolean read;
+ uint16 poll_tries; /* SLA+W NACKs answered by a new start (acknowledge polling) */
+ void (*callback)(struct TWI_Job *job); /* called from the TWI ISR when the job ends, NULL for none */
+ void *context; /* for the callback */
+ volatile TWI_JobStatus status;
+ struct TWI_Job *chain; /* next job of the same transaction, NULL for none */
+ struct TWI_Job *next; /* used by the queue */
+}TWI_Job;
+
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
 void TWI_init(const TWI_ConfigType * Config_Ptr);
+
+/*
+ * Description :
+ * The blocking functions wait at most TWI_TIMEOUT_MS for each step. A step that times out,
+ * loses the arbitration or hits a bus error recovers the bus, TWI_getStatus then
+ * returns TWI_NO_STATE so the caller sees the failed step.
+ */
 void TWI_start(void);
 void TWI_stop(void);
 void TWI_writeByte(uint8 data);
@@ -52,5 +109,38 @@ uint8 TWI_readByteWithACK(void);
 uint8 TWI_readByteWithNACK(void);
 uint8 TWI_getStatus(void);
 
+/*
+ * Description :
+ * Free a bus held by a slave: disconnect the TWI, clock SCL up to 9 times until the slave
+ * releases SDA, send a stop condition by hand and enable the TWI again with the same bit rate.
+ */
+void TWI_recoverBus(void);
+
+/*
+ * Description :
+ * Queue a job, it runs in the background from the TWI interrupt after the jobs queued before it.
+ * A job queued from a job callback runs right after that job, so a transfer made of several jobs
+ * (like the pages of an EEPROM write) is not split by other jobs.
+ * The jobs chained to it are queued with it, in order, and run without a stop between them
+ * (a job that fails ends the transaction with a stop, the next ones run with a new start).
+ * Return FALSE if a job is still queued or a read job has no data.
+ * The blocking functions above wait until the queue is empty, the global interrupts must be enabled.
+ */
+boolean TWI_submit(TWI_Job *job);
+
+/*
+ * Description :
+ * Return TRUE while a job is queued or running.
+ */
+boolean TWI_isBusy(void);
+
+/*
+ * Description :
+ * Watch the running job, it must be called periodically (and while waiting for a job).
+ * A job without any TWI interrupt for TWI_TIMEOUT_MS, or one ended by a bus error or a lost
+ * arbitration, is ended with its status, the bus is recovered and the queue goes on.
+ */
+void TWI_task(void);
+
 
 #endif /* TWI_H_ */
@@ -15,6 +15,24 @@
 
 #include "std_types.h"
 
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Ring buffers sizes used in the interrupt mode, must be a power of two (max 128) */
+#define UART_RX_BUFFER_SIZE 64
+#define UART_TX_BUFFER_SIZE 64
+
+/* Number of UART_BaudRate values */
+#define UART_BAUD_RATES_NUM 7
+
+/*
+ * Multi-processor communication mode (NINE_BIT only): a byte with the ninth bit set is an
+ * address, the hardware drops the data bytes that follow an address of another node.
+ */
+#define UART_BROADCAST_ADDRESS 0xFF /* accepted by every node */
+#define UART_NO_ADDRESS 0xFE /* address filtering disabled */
+
 /*******************************************************************************
  *                         Types Declaration                                   *
  *******************************************************************************/
@@ -31,13 +49,31 @@ typedef enum{
 	ONE_STOP_BIT, TWO_STOP_BIT
 }UART_StopBit;
 
-typedef uint32 UART_BaudRate;
+/* Supported baud rates, all of them are exact (or within 0.2%) at 8 MHz with U2X */
+typedef enum{
+	BAUD_9600, BAUD_19200, BAUD_38400, BAUD_76800, BAUD_250000, BAUD_500000, BAUD_1000000
+}UART_BaudRate;
+
+typedef enum{
+	POLLING_MODE, INTERRUPT_MODE
+}UART_Mode;
+
+/* Link quality counters, they wrap around at 65535 */
+typedef struct{
+ uint16 rx_bytes;
+ uint16 tx_bytes;
+ uint16 overruns; /* DOR: a byte was lost because UDR was not read in time */
+ uint16 framing_errors; /* FE: wrong stop bit, usually a baud rate mismatch or noise */
+ uint16 parity_errors; /* PE: only when the parity is enabled */
+ uint16 rx_dropped; /* the RX ring buffer was full */
+}UART_Stats;
 
 typedef struct{
  UART_BitData bit_data;
  UART_Parity parity;
  UART_StopBit stop_bit;
  UART_BaudRate baud_rate;
+ UART_Mode mode;
 }UART_ConfigType;
 
 /*******************************************************************************
@@ -50,18 +86,21 @@ typedef struct{
  * 1. Setup the Frame format like number of data bits, parity bit type and number of stop bits.
  * 2. Enable the UART.
  * 3. Setup the UART baud rate.
+ * 4. In the interrupt mode, reset the ring buffers and enable the RX Complete interrupt.
  */
 void UART_init(const UART_ConfigType * Config_Ptr);
 
 /*
  * Description :
  * Functional responsible for send byte to another UART device.
+ * In the interrupt mode it only waits if the TX ring buffer is full.
  */
 void UART_sendByte(const uint8 data);
 
 /*
  * Description :
  * Functional responsible for receive byte from another UART device.
+ * In the interrupt mode it waits until the RX ring buffer has a byte.
  */
 uint8 UART_recieveByte(void);
 
@@ -77,4 +116,64 @@ void UART_sendString(const uint8 *Str);
  */
 void UART_receiveString(uint8 *Str); // Receive until #
 
+/*
+ * Description :
+ * Non-blocking receive, returns TRUE and puts the byte in data if one is available,
+ * otherwise returns FALSE immediately.
+ */
+boolean UART_tryReceive(uint8 *data);
+
+/*
+ * Description :
+ * Return the number of received bytes that are waiting to be read.
+ */
+uint8 UART_available(void);
+
+/*
+ * Description :
+ * Non-blocking send, queue as many bytes as the TX ring buffer can hold
+ * and return the number of queued bytes.
+ * In the polling mode it sends the whole array.
+ */
+uint8 UART_write(const uint8 *data, uint8 size);
+
+/*
+ * Description :
+ * Wait until every queued byte has left the transmitter shift register.
+ */
+void UART_flush(void);
+
+/*
+ * Description :
+ * Change the baud rate after all queued bytes are sent, the frame format is kept.
+ */
+void UART_setBaudRate(UART_BaudRate baud_rate);
+
+/*
+ * Description :
+ * Enable the multi-processor communication mode filtering (NINE_BIT only),
+ * only the data bytes after this address or UART_BROADCAST_ADDRESS are received.
+ * UART_NO_ADDRESS disables the filtering.
+ */
+void UART_setAddress(uint8 address);
+
+/*
+ * Description :
+ * Send an address byte (ninth bit set) that selects the node receiving the next data bytes.
+ * It does nothing if the frame format is not NINE_BIT.
+ */
+void UART_sendAddress(uint8 address);
+
+/*
+ * Description :
+ * Copy the link quality counters counted since UART_init or UART_resetStats.
+ */
+void UART_getStats(UART_Stats *stats);
+
+/*
+ * Description :
+ * Clear all the link quality counters.
+ */
+void UART_resetStats(void);
+
 #endif /* UART_H_ */
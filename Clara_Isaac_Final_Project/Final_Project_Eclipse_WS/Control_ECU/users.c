@@ -0,0 +1,218 @@
+ /******************************************************************************
+ *
+ * Module: Users
+ *
+ * File Name: users.c
+ *
+ * Description: Source file for the user PIN table in the external EEPROM
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "users.h"
+#include <string.h> /* To use memcmp and memset functions */
+
+#if ((USERS_FIRST_PAGE + USERS_PAGES_NUM) > (EEPROM_SIZE / EEPROM_PAGE_SIZE)) || (USERS_PAGES_NUM < 2)
+#error "The user table needs a header page and at least 1 bucket page inside the EEPROM"
+#endif
+#if (USERS_MAX >= USERS_NO_USER)
+#error "The user number is one byte"
+#endif
+
+#define USERS_STATE_OFFSET 3
+
+/* EEPROM address of a bucket page and of an entry */
+#define USERS_PAGE_ADDRESS(bucket) ((uint32)(USERS_FIRST_PAGE + 1 + (bucket)) * EEPROM_PAGE_SIZE)
+#define USERS_ENTRY_ADDRESS(user) \
+	(USERS_PAGE_ADDRESS((user) / USERS_PER_PAGE) + ((user) % USERS_PER_PAGE) * USERS_ENTRY_SIZE)
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Header page of a cleared table, a change of the layout clears the table again */
+static const uint8 g_header[USERS_HEADER_SIZE] = {'U', 'S', 'E', 'R', 'S', 1, USERS_BUCKETS_NUM};
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Return the PIN digits as a number, as it is kept in the table.
+ */
+static uint32 USERS_pinValue(const uint8 *pin);
+
+/*
+ * Description:
+ * Return the first bucket page of a PIN.
+ */
+static uint8 USERS_bucket(uint32 value);
+
+/*
+ * Description:
+ * Search the PIN from its bucket page on, return the state of its entry and the user number,
+ * or USERS_EMPTY and the first free entry on the way (USERS_NO_USER if there is none).
+ */
+static uint8 USERS_search(uint32 value, uint8 *user, uint8 *free_user);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Check the header page of the table, the table is cleared if it is not there
+ * (blank EEPROM or an older layout). header holds the USERS_HEADER_SIZE bytes already
+ * read at boot, NULL_PTR to read them here. Return ERROR if the EEPROM can't be accessed.
+ */
+uint8 USERS_init(const uint8 *header)
+{
+	uint8 data[EEPROM_PAGE_SIZE], bucket;
+
+	if(header == NULL_PTR)
+	{
+		if(EEPROM_readBlock(USERS_HEADER_ADDRESS, data, USERS_HEADER_SIZE) != SUCCESS)
+			return ERROR;
+		header = data;
+	}
+	if(!memcmp(header, g_header, USERS_HEADER_SIZE))
+		return SUCCESS;
+
+	/* Every entry becomes empty, the header is written last so a cut clearing is done again */
+	memset(data, USERS_EMPTY, EEPROM_PAGE_SIZE);
+	for(bucket = 0; bucket < USERS_BUCKETS_NUM; bucket++)
+	{
+		if(EEPROM_writeBlock(USERS_PAGE_ADDRESS(bucket), data, EEPROM_PAGE_SIZE) != SUCCESS)
+			return ERROR;
+	}
+	return EEPROM_writeBlock(USERS_HEADER_ADDRESS, g_header, USERS_HEADER_SIZE);
+}
+
+/*
+ * Description:
+ * Look up the PIN (USERS_PIN_LENGTH ASCII digits), return USERS_ENABLED or USERS_DISABLED
+ * and the user number if it is in the table, USERS_EMPTY otherwise.
+ */
+uint8 USERS_find(const uint8 *pin, uint8 *user)
+{
+	uint8 free_user;
+
+	return USERS_search(USERS_pinValue(pin), user, &free_user);
+}
+
+/*
+ * Description:
+ * Add an enabled user with the PIN and return its number.
+ * Return ERROR if the PIN is already used or the table is full.
+ */
+uint8 USERS_add(const uint8 *pin, uint8 *user)
+{
+	uint8 entry[USERS_ENTRY_SIZE], found;
+	uint32 value = USERS_pinValue(pin);
+
+	/* The new entry is the first free one on the search path of the PIN */
+	if((USERS_search(value, &found, user) != USERS_EMPTY) || (*user == USERS_NO_USER))
+		return ERROR;
+
+	entry[0] = (uint8)value;
+	entry[1] = (uint8)(value >> 8);
+	entry[2] = (uint8)(value >> 16);
+	entry[USERS_STATE_OFFSET] = USERS_ENABLED;
+	return EEPROM_writeBlock(USERS_ENTRY_ADDRESS(*user), entry, USERS_ENTRY_SIZE);
+}
+
+/*
+ * Description:
+ * Enable, disable or remove a user (USERS_ENABLED, USERS_DISABLED or USERS_REMOVED).
+ * Return ERROR if there is no such user.
+ */
+uint8 USERS_setState(uint8 user, uint8 state)
+{
+	uint8 entry[USERS_ENTRY_SIZE];
+
+	if((user >= USERS_MAX) ||
+	   ((state != USERS_ENABLED) && (state != USERS_DISABLED) && (state != USERS_REMOVED)))
+		return ERROR;
+	if(EEPROM_readBlock(USERS_ENTRY_ADDRESS(user), entry, USERS_ENTRY_SIZE) != SUCCESS)
+		return ERROR;
+	if((entry[USERS_STATE_OFFSET] != USERS_ENABLED) && (entry[USERS_STATE_OFFSET] != USERS_DISABLED))
+		return ERROR;
+
+	if(state == USERS_REMOVED)
+	{
+		/* The PIN is cleared too, the entry can be taken by a new user */
+		memset(entry, USERS_REMOVED, USERS_ENTRY_SIZE);
+		return EEPROM_writeBlock(USERS_ENTRY_ADDRESS(user), entry, USERS_ENTRY_SIZE);
+	}
+	return EEPROM_writeByte(USERS_ENTRY_ADDRESS(user) + USERS_STATE_OFFSET, state);
+}
+
+/*
+ * Description:
+ * Return the PIN digits as a number, as it is kept in the table.
+ */
+static uint32 USERS_pinValue(const uint8 *pin)
+{
+	uint32 value = 0;
+	uint8 index;
+
+	for(index = 0; index < USERS_PIN_LENGTH; index++)
+	{
+		value = value * 10 + (uint8)(pin[index] - '0');
+	}
+	return value;
+}
+
+/*
+ * Description:
+ * Return the first bucket page of a PIN.
+ */
+static uint8 USERS_bucket(uint32 value)
+{
+	/* Multiplicative hash, the high bits mix all the digits so close PINs go to different pages */
+	return (uint8)(((value * 2654435761UL) >> 16) % USERS_BUCKETS_NUM);
+}
+
+/*
+ * Description:
+ * Search the PIN from its bucket page on, return the state of its entry and the user number,
+ * or USERS_EMPTY and the first free entry on the way (USERS_NO_USER if there is none).
+ */
+static uint8 USERS_search(uint32 value, uint8 *user, uint8 *free_user)
+{
+	uint8 page[EEPROM_PAGE_SIZE], bucket = USERS_bucket(value), probe, slot, state;
+	const uint8 *entry;
+
+	*free_user = USERS_NO_USER;
+	/* A full page sends the search to the next one, an empty entry on the way ends it */
+	for(probe = 0; probe < USERS_BUCKETS_NUM; probe++)
+	{
+		if(EEPROM_readBlock(USERS_PAGE_ADDRESS(bucket), page, EEPROM_PAGE_SIZE) != SUCCESS)
+		{
+			*free_user = USERS_NO_USER; /* nothing is added on a read error */
+			return USERS_EMPTY;
+		}
+		for(slot = 0; slot < USERS_PER_PAGE; slot++)
+		{
+			entry = &page[slot * USERS_ENTRY_SIZE];
+			state = entry[USERS_STATE_OFFSET];
+			if((state == USERS_EMPTY) || (state == USERS_REMOVED))
+			{
+				if(*free_user == USERS_NO_USER)
+					*free_user = bucket * USERS_PER_PAGE + slot;
+				if(state == USERS_EMPTY)
+					return USERS_EMPTY;
+			}
+			else if(((state == USERS_ENABLED) || (state == USERS_DISABLED)) &&
+					((entry[0] | ((uint32)entry[1] << 8) | ((uint32)entry[2] << 16)) == value))
+			{
+				*user = bucket * USERS_PER_PAGE + slot;
+				return state;
+			}
+		}
+		bucket = (bucket + 1) % USERS_BUCKETS_NUM;
+	}
+	return USERS_EMPTY;
+}
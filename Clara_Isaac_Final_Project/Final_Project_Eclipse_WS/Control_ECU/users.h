@@ -0,0 +1,90 @@
+ /******************************************************************************
+ *
+ * Module: Users
+ *
+ * File Name: users.h
+ *
+ * Description: Header file for the user PIN table in the external EEPROM. The table
+ *              is hashed by the PIN, checking a PIN reads one page in the usual case
+ *              however many users are stored.
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef USERS_H_
+#define USERS_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Pages of the table, after the pages of the audit log: a header page then the bucket pages */
+#ifndef USERS_FIRST_PAGE
+#define USERS_FIRST_PAGE 64
+#endif
+#ifndef USERS_PAGES_NUM
+#define USERS_PAGES_NUM 64
+#endif
+#define USERS_BUCKETS_NUM (USERS_PAGES_NUM - 1)
+
+/* Header at the start of the header page, it tells a cleared table of this layout */
+#define USERS_HEADER_ADDRESS ((uint32)USERS_FIRST_PAGE * EEPROM_PAGE_SIZE)
+#define USERS_HEADER_SIZE 7
+
+/*
+ * Entry: PIN as a number (3 bytes, little endian) | state.
+ * The user number is the place of the entry in the table, a bucket page holds 4 entries.
+ */
+#define USERS_PIN_LENGTH 5 /* digits, the same as the password */
+#define USERS_ENTRY_SIZE 4
+#define USERS_PER_PAGE (EEPROM_PAGE_SIZE / USERS_ENTRY_SIZE)
+#define USERS_MAX (USERS_BUCKETS_NUM * USERS_PER_PAGE) /* user numbers 0 to USERS_MAX - 1 */
+#define USERS_NO_USER 0xFF
+
+/*
+ * States of an entry. A removed entry is never empty again, a lookup goes on
+ * past it to the next page, only an empty entry ends the search.
+ */
+#define USERS_EMPTY 0xFF
+#define USERS_REMOVED 0x00
+#define USERS_ENABLED 0x5A
+#define USERS_DISABLED 0xA5
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Check the header page of the table, the table is cleared if it is not there
+ * (blank EEPROM or an older layout). header holds the USERS_HEADER_SIZE bytes already
+ * read at boot, NULL_PTR to read them here. Return ERROR if the EEPROM can't be accessed.
+ */
+uint8 USERS_init(const uint8 *header);
+
+/*
+ * Description:
+ * Look up the PIN (USERS_PIN_LENGTH ASCII digits), return USERS_ENABLED or USERS_DISABLED
+ * and the user number if it is in the table, USERS_EMPTY otherwise.
+ */
+uint8 USERS_find(const uint8 *pin, uint8 *user);
+
+/*
+ * Description:
+ * Add an enabled user with the PIN and return its number.
+ * Return ERROR if the PIN is already used or the table is full.
+ */
+uint8 USERS_add(const uint8 *pin, uint8 *user);
+
+/*
+ * Description:
+ * Enable, disable or remove a user (USERS_ENABLED, USERS_DISABLED or USERS_REMOVED).
+ * Return ERROR if there is no such user.
+ */
+uint8 USERS_setState(uint8 user, uint8 state);
+
+#endif /* USERS_H_ */
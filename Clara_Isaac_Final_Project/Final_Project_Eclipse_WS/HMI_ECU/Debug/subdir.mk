@@ -4,26 +4,35 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../crc.c \
 ../gpio.c \
 ../hmi_ecu.c \
 ../keypad.c \
 ../lcd.c \
+../link.c \
+../tick.c \
 ../timer1.c \
 ../uart.c 
 
 OBJS += \
+./crc.o \
 ./gpio.o \
 ./hmi_ecu.o \
 ./keypad.o \
 ./lcd.o \
+./link.o \
+./tick.o \
 ./timer1.o \
 ./uart.o 
 
 C_DEPS += \
+./crc.d \
 ./gpio.d \
 ./hmi_ecu.d \
 ./keypad.d \
 ./lcd.d \
+./link.d \
+./tick.d \
 ./timer1.d \
 ./uart.d 
 
@@ -0,0 +1,41 @@
+ /******************************************************************************
+ *
+ * Module: CRC
+ *
+ * File Name: crc.h
+ *
+ * Description: Header file for the table driven CRC-8 calculation
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* CRC-8 with polynomial x^8 + x^2 + x + 1 (0x07), initial value 0x00 */
+#define CRC8_INIT 0x00
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Add one byte to a running CRC-8 and return the new CRC value.
+ */
+uint8 CRC_update8(uint8 crc, uint8 data);
+
+/*
+ * Description :
+ * Calculate the CRC-8 of an array of bytes.
+ */
+uint8 CRC_calculate8(const uint8 *data, uint8 size);
+
+#endif /* CRC_H_ */
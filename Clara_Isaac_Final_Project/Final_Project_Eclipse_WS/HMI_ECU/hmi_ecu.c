@@ -12,61 +12,185 @@
 
 #include "std_types.h"
 #include "common_macros.h"
-#include "timer1.h"
 #include "lcd.h"
 #include "keypad.h"
 #include "uart.h"
+#include "link.h"
+#include "tick.h"
 #include <avr/io.h> /* To use SREG register */
-#include <util/delay.h> /* to use delay function */
 
 #define FAILED 0u
 #define SUCCEED 1u
 
-#define CHECK_PASS 0x10
-#define INCORRECT_PASS 0x11
-#define OPEN_DOOR 0x12
-#define CHANGE_PASS 0x13
+/* Doors on the bus, they use the addresses FIRST_DOOR_ADDRESS to FIRST_DOOR_ADDRESS + DOOR_COUNT - 1 */
+#ifndef DOOR_COUNT
+#define DOOR_COUNT 1
+#endif
+#define FIRST_DOOR_ADDRESS 1
+
+#if (DOOR_COUNT < 1) || (DOOR_COUNT > 9)
+#error "DOOR_COUNT must be 1 to 9, a door is selected by one keypad digit"
+#endif
+
+/*
+ * Requests, each one is answered by exactly one RESULT frame. The payload of a request starts with
+ * its sequence number and its RESULT starts with the same one, a request without an answer within
+ * REQUEST_TIMEOUT_MS is sent again with the same number so the door doesn't handle it twice.
+ */
+#define REQUEST_TIMEOUT_MS 250
+#define REQUEST_RETRIES 3
+#define SET_PASS 0x14 /* payload: new pass + new pass again */
+#define AUTH_AND_OPEN 0x15 /* payload: pass */
+#define AUTH_AND_CHANGE 0x16 /* payload: old pass + new pass + new pass again */
+#define GET_STATUS 0x17 /* no payload, answered by RESULT_SUCCEED or RESULT_NO_PASS + the door state */
+#define CHANGE_WITH_TOKEN 0x19 /* payload: session token + new pass + new pass again */
+#define AUDIT_DUMP 0x1A /* payload: pass + page index (0 = newest), answered by RESULT_SUCCEED + the page or RESULT_REJECTED */
+#define USER_ADD 0x1B /* payload: pass + new PIN + new PIN again, answered by RESULT_SUCCEED + the user number */
+#define USER_SET 0x1C /* payload: pass + user number + USER_ENABLE, USER_DISABLE or USER_REMOVE */
+#define RESULT 0x20
+
+/* Door state events pushed by the control ECU, each one is acknowledged by an EVENT_ACK */
+#define DOOR_EVENT 0x21 /* payload: event */
+#define EVENT_ACK 0x22 /* payload: the acknowledged event */
+
+/* Events */
+#define DOOR_UNLOCKING 1
+#define DOOR_HELD 2
+#define DOOR_LOCKING 3
+#define DOOR_CLOSED 4
+#define ALARM_START 5
+#define ALARM_END 6
+
+/*
+ * Length of the sequences run by the control ECU, the door state is asked with GET_STATUS
+ * when the last event did not come EVENT_MARGIN_MS after them, and again every EVENT_MARGIN_MS.
+ */
+#define DOOR_SEQUENCE_MS 33000UL /* unlocking 15 sec, open 3 sec, locking 15 sec */
+#define ALARM_SEQUENCE_MS 60000UL
+#define EVENT_MARGIN_MS 2000UL
+
+/* Results */
+#define RESULT_SUCCEED 'S'
+#define RESULT_FAILED 'F' /* wrong password */
+#define RESULT_MISMATCH 'M' /* the 2 new passwords are not matched */
+#define RESULT_ALARM 'A' /* wrong password for the third time, alarm is on */
+#define RESULT_BUSY 'B' /* the door or the alarm sequence is still running */
+#define RESULT_NO_PASS 'N' /* the password of this door is not set yet */
+#define RESULT_NO_SESSION 'T' /* the session token is wrong or expired, the password is needed */
+#define RESULT_REJECTED 'R' /* the PIN is already used or the table is full, no such user or audit page */
+#define RESULT_NOT_SAVED 'E' /* the EEPROM write failed, the stored password is unchanged */
+#define RESULT_LINK_DOWN 'L' /* never sent, the door stopped answering while waiting */
+
+/* Operations of USER_SET */
+#define USER_REMOVE 0
+#define USER_ENABLE 1
+#define USER_DISABLE 2
+
+/*
+ * Audit log page sent by the Control ECU: boot number | 3 records,
+ * record: event | detail | seconds since the boot (2 bytes, little endian), unused records have the event 0xFF
+ */
+#define AUDIT_PAGE_SIZE 13
+#define AUDIT_BOOT_OFFSET 0
+#define AUDIT_RECORDS_OFFSET 1
+#define AUDIT_RECORD_SIZE 4
+#define AUDIT_RECORDS_PER_PAGE 3
+#define AUDIT_NO_EVENT 0xFF
+#define AUDIT_EVENTS_NUM 10 /* event codes 1 - 9 */
+
+#define USER_NONE 0xFF /* user numbers are 0 to 251 */
+
+/*
+ * A change with the correct old password and 2 different new ones opens a session, its token
+ * replaces the old password only in the retry of the new one that follows right away
+ */
+#define SESSION_TOKEN_LENGTH 4
+#ifndef SESSION_WINDOW_MS
+#define SESSION_WINDOW_MS 30000UL
+#endif
+
+#define PASS_LENGTH 5
 
 /*******************************************************************************
  *                       Variables Declarations                                *
  *******************************************************************************/
-uint8 g_counter = 0;
+uint8 g_door = FIRST_DOOR_ADDRESS; /* the selected door */
+boolean g_connected = FALSE; /* the selected door answered, its link is watched */
+boolean g_sessionOpen = FALSE; /* a token was received from g_sessionDoor */
+uint8 g_sessionDoor = FIRST_DOOR_ADDRESS;
+uint8 g_sessionToken[SESSION_TOKEN_LENGTH];
+uint32 g_sessionTime = 0; /* time the token was received */
+uint8 g_resultDetail = 0; /* the byte sent after the last result, the user number of USER_ADD */
+uint8 g_requestSeq = 0; /* sequence number of the last request */
 
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
 
-void APP_setPass(void); /* set the password */
-void APP_getPassFromUser(void); /* get the password from user */
-uint8 APP_checkPass(void); /* take the password from user and check if it is matched with the fixed one */
+uint8 APP_request(uint8 type, const uint8 a_payload[], uint8 length, LINK_Frame *a_reply); /* send a request and wait for its result */
+boolean APP_idleTask(void); /* serve the link while waiting for the user */
+void APP_delayMs(uint16 ms); /* wait while serving the link */
+void APP_linkDown(const uint8 a_doors[]); /* show the link down screen and connect again */
+boolean APP_hasSession(void); /* check if the selected door has an open session */
+uint8 APP_selectDoor(void); /* let the user choose the door when there is more than one */
+boolean APP_connectDoor(void); /* check that the selected door answers and has a password */
+void APP_setupPass(void); /* set the first password of the selected door */
+void APP_showNotSaved(void); /* tell the user the door could not store the password */
+boolean APP_readPass(uint8 a_pass[]); /* read PASS_LENGTH digits from the keypad followed by ENTER */
+boolean APP_getNewPass(uint8 a_passes[]); /* get the new password twice from user */
+boolean APP_getPassFromUser(uint8 a_pass[]); /* get the password from user */
+uint8 APP_authAndOpen(void); /* take the password from user and ask the control ECU to open the door */
+uint8 APP_authAndChange(void); /* take the old and new passwords and ask the control ECU to change it */
+uint8 APP_changeWithToken(void); /* take the new password and send it with the session token */
+void APP_showEvent(uint8 event); /* print the state pushed by the control ECU on the LCD */
+void APP_waitForEvent(uint8 last_event, uint32 duration); /* show the pushed states until the last one of the sequence */
 void APP_openDoor(void); /* printing on the LCD the state of the door */
 void APP_alarm(void); /* printing on the LCD while the buzzer is on */
-void APP_timerCounter(void); /* Timer1 Callback function */
+void APP_showStats(void); /* print the link error counters of the selected door and of this ECU */
+void APP_showAudit(void); /* print the audit log of the selected door, newest event first */
+uint8 APP_readUser(void); /* read a user number from the keypad followed by ENTER */
+void APP_manageUsers(void); /* add, enable, disable or remove a user PIN of the selected door */
 
 int main(void)
 {
 	/* Variables Declaration */
-	uint8 a_checkPass, a_choice;
-	UART_ConfigType uart_config = {EIGHT_BIT, DISABLED, ONE_STOP_BIT, 9600}; /* UART configuration */
+	uint8 a_choice, a_result, a_doors[DOOR_COUNT];
+	UART_ConfigType uart_config = {NINE_BIT, DISABLED, ONE_STOP_BIT, BAUD_9600, INTERRUPT_MODE}; /* UART configuration */
 
 	/* Enabling Global Interrupt Register */
 	SREG |= (1<<7);
 
+	/* System tick initialization, used for the link timeouts */
+	TICK_init();
 	/* UART initialization */
 	UART_init(&uart_config);
+	/* The HMI ECU is the bus master, the doors send their frames to it only */
+	LINK_init(LINK_HMI_ADDRESS, FIRST_DOOR_ADDRESS);
 	/* LCD initialization */
 	LCD_init();
+	/* The heartbeat keeps running while the user types */
+	KEYPAD_setIdleCallBack(APP_idleTask);
 
-	a_checkPass = 'F';
-	/* Set the password before anything */
-	while(a_checkPass != 'S') /* loop until the user enters the SAME password twice */
+	/* Agree with all the doors on the fastest rate that passes the link test */
+	LCD_displayString("Connecting...");
+	for(a_choice = 0; a_choice < DOOR_COUNT; a_choice++)
 	{
-		APP_setPass();
-		a_checkPass = UART_recieveByte(); /* receive from the second ECU if they are matched 'S' or not 'F' */
+		a_doors[a_choice] = FIRST_DOOR_ADDRESS + a_choice;
 	}
+	LINK_negotiateBaud(a_doors, DOOR_COUNT);
 
 	while(1)
 	{
+		if(g_connected && !LINK_isUp())
+			APP_linkDown(a_doors);
+
+		/* Every request goes to the selected door only */
+		g_connected = FALSE;
+		g_door = APP_selectDoor();
+		LINK_setPeer(g_door);
+		if(!APP_connectDoor())
+			continue;
+
 		/* Print the list of options on LCD */
 		LCD_clearScreen();
 		LCD_displayString("+ : Open Door");
@@ -76,37 +200,47 @@ int main(void)
 		/* Take the choice from user */
 		do
 			a_choice = KEYPAD_getPressedKey();
-		while((a_choice != '+') && (a_choice != '-')); /* other than the two options do nothing */
+		while((a_choice != '+') && (a_choice != '-') && (a_choice != '*') && (a_choice != '%')
+			  && (a_choice != '=') && (a_choice != KEYPAD_NO_KEY)); /* other than the options do nothing */
 
+		if(a_choice == KEYPAD_NO_KEY)
+			continue; /* the link is down */
+		if(a_choice == '*')
+		{
+			/* hidden diagnostic screen for the service technician */
+			APP_showStats();
+			continue;
+		}
+		if(a_choice == '%')
+		{
+			/* hidden audit log screen, who opened the door and when */
+			APP_showAudit();
+			continue;
+		}
+		if(a_choice == '=')
+		{
+			/* the user PINs, they open the door but can't change the password */
+			APP_manageUsers();
+			continue;
+		}
 		if (a_choice == '+')
 		{
-			/* take the password and check on it max 3 times */
-			if(APP_checkPass())
-				APP_openDoor();
-			else
-			{
-				APP_alarm();
-			}
+			/* take the password and send it with the open request, max 3 times */
+			a_result = APP_authAndOpen();
 		}
-		else if(a_choice == '-')
+		else
 		{
-			/* take the password and check on it max 3 times */
-			if(APP_checkPass())
-			{
-				/* Reset the password */
-				a_checkPass = 'F';
-				UART_sendByte(CHANGE_PASS);
-				while(a_checkPass != 'S') /* loop until the user enters the SAME password twice */
-				{
-					APP_setPass();
-					a_checkPass = UART_recieveByte(); /* receive from the second ECU if they are matched 'S' or not 'F' */
-				}
-			}
-			else
-			{
-				APP_alarm();
-			}
+			/* take the old and new passwords and send them in one request, max 3 wrong tries */
+			a_result = APP_authAndChange();
 		}
+		if((a_result == RESULT_SUCCEED) && (a_choice == '+'))
+			APP_openDoor();
+		else if(a_result == RESULT_ALARM)
+			APP_alarm();
+		else if(a_result == RESULT_NO_PASS)
+			APP_setupPass(); /* the control ECU restarted meanwhile */
+		else if(a_result == RESULT_NOT_SAVED)
+			APP_showNotSaved();
 	}
 }
 
@@ -116,41 +250,251 @@ int main(void)
 
 /*
  * Description:
- * Take the password twice for confirmation and send them to the control ECU.
+ * Send a request to the selected door with a new sequence number and wait for its RESULT frame,
+ * the request is sent again when no RESULT came within REQUEST_TIMEOUT_MS.
+ * Return the result, or RESULT_LINK_DOWN if the door does not answer. The RESULT payload without
+ * its sequence number is copied to a_reply if it is not NULL_PTR, a session token sent after the
+ * result is kept for the next requests.
  */
-void APP_setPass(void)
+uint8 APP_request(uint8 type, const uint8 a_payload[], uint8 length, LINK_Frame *a_reply)
 {
-	/* Variables declarations */
-	uint8 a_index = 0, a_pass1[7] = "96321", a_pass2[7] = "96321#";
+	LINK_Frame a_frame;
+	uint8 a_request[LINK_MAX_PAYLOAD], a_index, a_attempt;
+	boolean a_received = FALSE;
+	uint32 a_start;
 
-	/* Get the password from user */
+	g_requestSeq++;
+	a_request[0] = g_requestSeq;
+	for(a_index = 0; a_index < length; a_index++)
+	{
+		a_request[1 + a_index] = a_payload[a_index];
+	}
+
+	for(a_attempt = 0; (a_attempt <= REQUEST_RETRIES) && !a_received; a_attempt++)
+	{
+		LINK_sendFrame(type, a_request, 1 + length);
+		a_start = TICK_getMs();
+		while(!a_received && (TICK_elapsedMs(a_start) < REQUEST_TIMEOUT_MS))
+		{
+			if(g_connected && !LINK_isUp())
+				return RESULT_LINK_DOWN;
+			if(!LINK_receiveFrame(&a_frame))
+				continue;
+			/* acknowledge re-sent events, a RESULT of an older request is late and dropped */
+			if((a_frame.type == DOOR_EVENT) && (a_frame.length == 1))
+				LINK_sendFrame(EVENT_ACK, a_frame.payload, 1);
+			a_received = (a_frame.type == RESULT) && (a_frame.length >= 2) && (a_frame.payload[0] == g_requestSeq);
+		}
+	}
+	if(!a_received)
+		return RESULT_LINK_DOWN;
+
+	/* the callers see the RESULT payload from the result on */
+	a_frame.length--;
+	for(a_index = 0; a_index < a_frame.length; a_index++)
+	{
+		a_frame.payload[a_index] = a_frame.payload[1 + a_index];
+	}
+	if(a_frame.length == 1 + SESSION_TOKEN_LENGTH)
+	{
+		for(a_index = 0; a_index < SESSION_TOKEN_LENGTH; a_index++)
+		{
+			g_sessionToken[a_index] = a_frame.payload[1 + a_index];
+		}
+		g_sessionOpen = TRUE;
+		g_sessionDoor = g_door;
+		g_sessionTime = TICK_getMs();
+	}
+	else if(a_frame.payload[0] == RESULT_NO_SESSION)
+		g_sessionOpen = FALSE;
+	else if(a_frame.length == 2)
+		g_resultDetail = a_frame.payload[1];
+	if(a_reply != NULL_PTR)
+		*a_reply = a_frame;
+	return a_frame.payload[0];
+}
+
+/*
+ * Description:
+ * Keypad idle callback: send the heartbeat and acknowledge the events the door re-sends.
+ * Return FALSE to stop waiting for the user when the selected door stopped answering.
+ */
+boolean APP_idleTask(void)
+{
+	LINK_Frame a_frame;
+
+	while(LINK_receiveFrame(&a_frame))
+	{
+		if((a_frame.type == DOOR_EVENT) && (a_frame.length == 1))
+			LINK_sendFrame(EVENT_ACK, a_frame.payload, 1);
+	}
+	return !g_connected || LINK_isUp();
+}
+
+/*
+ * Description:
+ * Wait for the given time while the heartbeat keeps running.
+ */
+void APP_delayMs(uint16 ms)
+{
+	uint32 a_start = TICK_getMs();
+
+	while(TICK_elapsedMs(a_start) < ms)
+	{
+		APP_idleTask();
+	}
+}
+
+/*
+ * Description:
+ * The selected door stopped answering within LINK_DEAD_MS: it has already started locking itself,
+ * show it on the LCD and agree on the rate again, the door may have restarted at the default one.
+ */
+void APP_linkDown(const uint8 a_doors[])
+{
+	g_connected = FALSE;
+	g_sessionOpen = FALSE;
 	LCD_clearScreen();
-	LCD_displayString("Plz enter pass: ");
+	LCD_displayString("Link down");
+	LCD_moveCursor(1,0);
+	LCD_displayString("Reconnecting...");
+	LINK_negotiateBaud(a_doors, DOOR_COUNT);
+}
+
+/*
+ * Description:
+ * Return TRUE if the selected door sent a session token that is still within its window.
+ */
+boolean APP_hasSession(void)
+{
+	return g_sessionOpen && (g_sessionDoor == g_door)
+		   && (TICK_elapsedMs(g_sessionTime) < SESSION_WINDOW_MS);
+}
+
+/*
+ * Description:
+ * Return the address of the door chosen by the user, the screen is skipped
+ * when there is only one door.
+ */
+uint8 APP_selectDoor(void)
+{
+	uint8 a_key;
+
+	if(DOOR_COUNT == 1)
+		return FIRST_DOOR_ADDRESS;
+
+	LCD_clearScreen();
+	LCD_displayString("Select door");
+	LCD_moveCursor(1,0);
+	LCD_displayString("1 to ");
+	LCD_displayCharacter('0' + DOOR_COUNT);
+	do
+		a_key = KEYPAD_getPressedKey();
+	while((a_key < '1') || (a_key > '0' + DOOR_COUNT)); /* other keys do nothing */
+	APP_delayMs(500); /* time of press */
+	return FIRST_DOOR_ADDRESS + (a_key - '1');
+}
+
+/*
+ * Description:
+ * Ask the selected door for its status, set its first password if it has none.
+ * Return FALSE if the door does not answer.
+ */
+boolean APP_connectDoor(void)
+{
+	uint8 a_result = APP_request(GET_STATUS, NULL_PTR, 0, NULL_PTR);
+
+	if(a_result == RESULT_LINK_DOWN)
+	{
+		LCD_clearScreen();
+		LCD_displayString("Door not found");
+		APP_delayMs(1000);
+		return FALSE;
+	}
+	g_connected = TRUE;
+	if(a_result == RESULT_NO_PASS)
+		APP_setupPass();
+	return TRUE;
+}
+
+/*
+ * Description:
+ * Set the password of the selected door before anything.
+ */
+void APP_setupPass(void)
+{
+	uint8 a_passes[2 * PASS_LENGTH], a_result;
+
+	do
+	{
+		if(!APP_getNewPass(a_passes))
+			return; /* the link is down */
+		a_result = APP_request(SET_PASS, a_passes, 2 * PASS_LENGTH, NULL_PTR);
+		if(a_result == RESULT_NOT_SAVED)
+			APP_showNotSaved();
+	}while((a_result != RESULT_SUCCEED) && (a_result != RESULT_LINK_DOWN)); /* loop until the user enters the SAME password twice */
+}
+
+/*
+ * Description:
+ * Show for 2 sec that the door failed to store the password, the stored one is unchanged.
+ */
+void APP_showNotSaved(void)
+{
+	LCD_clearScreen();
+	LCD_displayString("Pass not saved");
 	LCD_moveCursor(1,0);
+	LCD_displayString("EEPROM error");
+	APP_delayMs(2000);
+}
+
+/*
+ * Description:
+ * Read the password digits from the keypad, then wait for the ENTER key.
+ * Return FALSE if the link went down before, the password is not complete.
+ */
+boolean APP_readPass(uint8 a_pass[])
+{
+	uint8 a_index = 0, a_key;
 	while(1)
 	{
-		if (a_index == 5)
+		a_key = KEYPAD_getPressedKey();
+		if (a_key == KEYPAD_NO_KEY)
 		{
-			a_pass1[a_index] = KEYPAD_getPressedKey();
-			if (a_pass1[a_index] == 13) /* ENTER (the user have finish entering the password) */
+			return FALSE; /* the link is down */
+		}
+		if (a_index == PASS_LENGTH)
+		{
+			if (a_key == 13) /* ENTER (the user have finish entering the password) */
 			{
-				a_index = 0;
 				break;
 			}
-
 		}
-		else
+		/* Password consists of numbers only */
+		else if((a_key >= '0') &&  (a_key <= '9'))
 		{
-			/* Password consists of numbers only */
-			a_pass1[a_index] = KEYPAD_getPressedKey();
-			if((a_pass1[a_index] >= '0') &&  (a_pass1[a_index] <= '9'))
-			{
-				LCD_displayCharacter('*');
-				a_index++;
-			}
+			a_pass[a_index] = a_key;
+			LCD_displayCharacter('*');
+			a_index++;
 		}
-		_delay_ms(500); /* time of press */
+		APP_delayMs(500); /* time of press */
 	}
+	return TRUE;
+}
+
+/*
+ * Description:
+ * Take the password twice for confirmation.
+ * Return FALSE if the link went down before.
+ */
+boolean APP_getNewPass(uint8 a_passes[])
+{
+	/* Get the password from user */
+	LCD_clearScreen();
+	LCD_displayString("Plz enter pass: ");
+	LCD_moveCursor(1,0);
+	if(!APP_readPass(a_passes))
+		return FALSE;
 
 	/* Get the password from user a second time*/
 	LCD_clearScreen();
@@ -158,155 +502,412 @@ void APP_setPass(void)
 	LCD_moveCursor(1,0);
 	LCD_displayString("same pass: ");
 	LCD_moveCursor(1, 11);
+	return APP_readPass(&a_passes[PASS_LENGTH]);
+}
+
+/*
+ * Description:
+ * Get password from user.
+ * Return FALSE if the link went down before.
+ */
+boolean APP_getPassFromUser(uint8 a_pass[])
+{
+	LCD_clearScreen();
+	LCD_displayString("Plz enter pass: ");
+	LCD_moveCursor(1,0);
+	return APP_readPass(a_pass);
+}
+
+/*
+ * Description:
+ * Send the password with the open request in one frame until the control ECU accepts it
+ * or turns the alarm on after the third wrong try.
+ */
+uint8 APP_authAndOpen(void)
+{
+	/* Variable declaration */
+	uint8 a_pass[PASS_LENGTH], a_result;
+
+	do
+	{
+		if(!APP_getPassFromUser(a_pass)) /* user enters the password */
+			return RESULT_LINK_DOWN;
+		a_result = APP_request(AUTH_AND_OPEN, a_pass, PASS_LENGTH, NULL_PTR);
+	}while(a_result == RESULT_FAILED);
+	return a_result;
+}
+
+/*
+ * Description:
+ * Send the old password and the new one twice in one frame until the control ECU changes it
+ * or turns the alarm on after the third wrong try.
+ */
+uint8 APP_authAndChange(void)
+{
+	/* Variable declaration */
+	uint8 a_request[3 * PASS_LENGTH], a_result;
+
+	if(!APP_getPassFromUser(a_request)) /* the old password, always asked */
+		return RESULT_LINK_DOWN;
 	while(1)
 	{
-		if (a_index == 5)
+		if(!APP_getNewPass(&a_request[PASS_LENGTH]))
 		{
-			a_pass2[a_index] = KEYPAD_getPressedKey();
-			if (a_pass2[a_index] == 13) /* ENTER (the user have finish entering the password) */
-			{
-				break;
-			}
+			a_result = RESULT_LINK_DOWN;
+			break;
 		}
-		else
+		a_result = APP_request(AUTH_AND_CHANGE, a_request, 3 * PASS_LENGTH, NULL_PTR);
+		if(a_result == RESULT_FAILED)
 		{
-			/* Password consists of numbers only */
-			a_pass2[a_index] = KEYPAD_getPressedKey();
-			if((a_pass2[a_index] >= '0') &&  (a_pass2[a_index] <= '9'))
-			{
-				LCD_displayCharacter('*');
-				a_index++;
-			}
+			/* wrong old password, take it again */
+			if(!APP_getPassFromUser(a_request))
+				return RESULT_LINK_DOWN;
+		}
+		else if(a_result != RESULT_MISMATCH)
+		{
+			break; /* the new password is matched, re-take it only otherwise */
+		}
+		else if(APP_hasSession())
+		{
+			/* the old password was correct, retry with the token, the old password is sent again if it expired */
+			a_result = APP_changeWithToken();
+			if(a_result != RESULT_NO_SESSION)
+				break;
 		}
-		_delay_ms(500); /* time of press */
 	}
-	a_pass1[5] = '#';
-	a_pass2[5] = '#';
-	a_pass1[6] = '\0';
-	a_pass2[6] = '\0';
-	/* send the 2 inputs to Control ECU */
-	UART_sendString(a_pass1);
-	UART_sendString(a_pass2);
+	/* The token serves this change only */
+	g_sessionOpen = FALSE;
+	return a_result;
 }
 
 /*
  * Description:
- * Get password from user and send it to control ECU.
+ * Send the new password twice with the session token instead of the old password,
+ * until the 2 new passwords are matched or the token is refused.
  */
-void APP_getPassFromUser(void)
+uint8 APP_changeWithToken(void)
 {
-	uint8 a_index = 0, a_pass[7] = "96321#";
-	LCD_clearScreen();
-	LCD_displayString("Plz enter pass: ");
-	LCD_moveCursor(1,0);
+	/* Variable declaration */
+	uint8 a_request[SESSION_TOKEN_LENGTH + 2 * PASS_LENGTH], a_index, a_result;
+
+	for(a_index = 0; a_index < SESSION_TOKEN_LENGTH; a_index++)
+	{
+		a_request[a_index] = g_sessionToken[a_index];
+	}
+	do
+	{
+		if(!APP_getNewPass(&a_request[SESSION_TOKEN_LENGTH]))
+			return RESULT_LINK_DOWN;
+		a_result = APP_request(CHANGE_WITH_TOKEN, a_request, SESSION_TOKEN_LENGTH + 2 * PASS_LENGTH, NULL_PTR);
+	}while(a_result == RESULT_MISMATCH);
+	return a_result;
+}
+
+/*
+ * Description:
+ * Print the state of the door pushed by the control ECU.
+ */
+void APP_showEvent(uint8 event)
+{
+	switch(event)
+	{
+	case DOOR_UNLOCKING:
+		LCD_clearScreen();
+		LCD_displayString("Door is ");
+		LCD_moveCursor(1,0);
+		LCD_displayString("unlocking");
+		break;
+	case DOOR_HELD:
+		LCD_moveCursor(1,0);
+		LCD_displayString("open     ");
+		break;
+	case DOOR_LOCKING:
+		LCD_moveCursor(1,0);
+		LCD_displayString("locking  ");
+		break;
+	case ALARM_START:
+		LCD_clearScreen();
+		LCD_displayString("INCORRECT PASS");
+		break;
+	}
+}
+
+/*
+ * Description:
+ * Acknowledge and show every state pushed by the control ECU until the last one of the sequence,
+ * the control ECU is the only timing source of the sequence. The door gives up an event that is
+ * not acknowledged, so the door state is asked when the sequence of the given duration is over
+ * and the last event did not come.
+ */
+void APP_waitForEvent(uint8 last_event, uint32 duration)
+{
+	LINK_Frame a_frame;
+	uint32 a_deadline = duration + EVENT_MARGIN_MS, a_start = TICK_getMs();
+	uint8 a_result;
+
 	while(1)
 	{
-		if (a_index == 5)
+		if(!LINK_isUp())
+			break; /* the door locks itself when the link is down */
+		if(TICK_elapsedMs(a_start) >= a_deadline)
 		{
-			a_pass[a_index] = KEYPAD_getPressedKey(); /* ENTER (the user have finish entering the password) */
-			if (a_pass[a_index] == 13)
+			a_result = APP_request(GET_STATUS, NULL_PTR, 0, NULL_PTR);
+			if((a_result == RESULT_LINK_DOWN) || (g_resultDetail == DOOR_CLOSED) || (g_resultDetail == ALARM_END))
+				break; /* the sequence is over, its last event is lost */
+			a_deadline = EVENT_MARGIN_MS; /* still running, ask again later */
+			a_start = TICK_getMs();
+		}
+		if(!LINK_receiveFrame(&a_frame) || (a_frame.type != DOOR_EVENT) || (a_frame.length != 1))
+			continue;
+		/* acknowledge re-sent events too, the last acknowledge may be lost */
+		LINK_sendFrame(EVENT_ACK, a_frame.payload, 1);
+		APP_showEvent(a_frame.payload[0]);
+		if(a_frame.payload[0] == last_event)
+			break;
+	}
+}
+
+/*
+ * Description:
+ * Display on the LCD the state of the door while the control ECU opens it,
+ * unlocking (15 sec), open (3 sec) then locking (15 sec).
+ */
+void APP_openDoor(void)
+{
+	APP_waitForEvent(DOOR_CLOSED, DOOR_SEQUENCE_MS);
+}
+
+/*
+ * Description:
+ * Display on LCD "INCORRECT PASS" while the buzzer is on for 1 min.
+ */
+void APP_alarm(void)
+{
+	APP_waitForEvent(ALARM_END, ALARM_SEQUENCE_MS);
+}
+
+/*
+ * Description:
+ * Print the link error counters of the selected door, then of this ECU,
+ * each screen is left by pressing any key.
+ * F: framing errors, O: overruns, P: parity errors, C: CRC errors, R: retries,
+ * D: bytes dropped because the RX buffer was full
+ */
+void APP_showStats(void)
+{
+	UART_Stats a_uartStats;
+	LINK_Stats a_linkStats;
+	uint8 a_page;
+
+	APP_delayMs(500); /* time of press */
+	for(a_page = 0; a_page < 2; a_page++)
+	{
+		LCD_clearScreen();
+		if(a_page == 0)
+		{
+			if(!LINK_requestStats(&a_uartStats, &a_linkStats))
 			{
-				break;
+				LCD_displayString("Door not found");
+				APP_delayMs(1000);
+				continue;
 			}
+			LCD_displayString("Door ");
 		}
 		else
 		{
-			/* Password consists of numbers only */
-			a_pass[a_index] = KEYPAD_getPressedKey();
-			if((a_pass[a_index] >= '0') &&  (a_pass[a_index] <= '9'))
-			{
-				LCD_displayCharacter('*');
-				a_index++;
-			}
+			UART_getStats(&a_uartStats);
+			LINK_getStats(&a_linkStats);
+			LCD_displayString("HMI  ");
 		}
-		_delay_ms(500); /* time of press */
+		LCD_displayString("F");
+		LCD_intgerToString(a_uartStats.framing_errors);
+		LCD_displayString(" O");
+		LCD_intgerToString(a_uartStats.overruns);
+		LCD_displayString(" P");
+		LCD_intgerToString(a_uartStats.parity_errors);
+		LCD_moveCursor(1,0);
+		LCD_displayString("C");
+		LCD_intgerToString(a_linkStats.crc_errors);
+		LCD_displayString(" R");
+		LCD_intgerToString(a_linkStats.retries);
+		LCD_displayString(" D");
+		LCD_intgerToString(a_uartStats.rx_dropped);
+		KEYPAD_getPressedKey();
+		APP_delayMs(500); /* time of press */
 	}
-	a_pass[5] = '#';
-	a_pass[6] = '\0';
-	/* send the input to Control ECU */
-	UART_sendString(a_pass);
 }
 
 /*
  * Description:
- * Display on the LCD "Door is unlocking for 18 seconds (15 CW + 3 Stop), then
- * Display on the LCD "Door is unlocking for 15 seconds (15 ACW).
+ * Take the password, then read the audit log of the selected door page by page and print
+ * one event at a time, newest first. Any key shows the next event, '=' leaves.
  */
-void APP_openDoor(void)
+void APP_showAudit(void)
 {
-	Timer1_ConfigType timer1_config = {0, 0, F_CPU_1024, COMPARE_MODE}; /* Timer configurations */
-	/* Set the callback function */
-	Timer1_setCallBack(APP_timerCounter);
-	UART_sendByte(OPEN_DOOR); /* Announce the control ECU that we are in the state of opening the door */
-	/* Prepare the LCD */
+	static const char *const a_names[AUDIT_EVENTS_NUM] = {
+		"Event", "Boot", "Pass set", "Opened", "Wrong pass", "Alarm", "Pass changed", "Link lost",
+		"User opened", "User changed"
+	};
+	LINK_Frame a_reply;
+	uint8 a_request[PASS_LENGTH + 1], a_record, a_key, a_result;
+	const uint8 *a_event;
+
+	APP_delayMs(500); /* time of press */
+	if(!APP_getPassFromUser(a_request)) /* only the password reads the log */
+		return;
+	for(a_request[PASS_LENGTH] = 0; ; a_request[PASS_LENGTH]++)
+	{
+		a_result = APP_request(AUDIT_DUMP, a_request, PASS_LENGTH + 1, &a_reply);
+		if(a_result == RESULT_ALARM)
+		{
+			APP_alarm();
+			return;
+		}
+		if(a_result == RESULT_NO_PASS)
+		{
+			APP_setupPass(); /* the control ECU restarted meanwhile */
+			return;
+		}
+		if(a_result == RESULT_LINK_DOWN)
+			return;
+		if(a_result == RESULT_FAILED)
+		{
+			LCD_clearScreen();
+			LCD_displayString("Wrong pass");
+			APP_delayMs(1000);
+			return;
+		}
+		if((a_result != RESULT_SUCCEED) || (a_reply.length != 1 + AUDIT_PAGE_SIZE))
+			break; /* past the oldest page */
+
+		/* the newest event of the page first */
+		for(a_record = AUDIT_RECORDS_PER_PAGE; a_record > 0; a_record--)
+		{
+			a_event = &a_reply.payload[1 + AUDIT_RECORDS_OFFSET + (a_record - 1) * AUDIT_RECORD_SIZE];
+			if(a_event[0] == AUDIT_NO_EVENT)
+				continue;
+			LCD_clearScreen();
+			LCD_displayString(a_names[(a_event[0] < AUDIT_EVENTS_NUM) ? a_event[0] : 0]);
+			LCD_displayString(" ");
+			LCD_intgerToString(a_event[1]);
+			LCD_moveCursor(1,0);
+			LCD_displayString("Boot ");
+			LCD_intgerToString(a_reply.payload[1 + AUDIT_BOOT_OFFSET]);
+			LCD_displayString(" +");
+			LCD_intgerToString((a_event[2] | ((uint16)a_event[3] << 8)) / 60);
+			LCD_displayString("min");
+			a_key = KEYPAD_getPressedKey();
+			APP_delayMs(500); /* time of press */
+			if((a_key == '=') || (a_key == KEYPAD_NO_KEY))
+				return;
+		}
+	}
 	LCD_clearScreen();
-	LCD_displayString("Door is ");
-	LCD_moveCursor(1,0);
-	LCD_displayString("unlocking");
-	/* set the compare value */
-	timer1_config.compare_value = 17578; /* for 18 sec */
-	/* Start the timer*/
-	Timer1_init(&timer1_config);
-	while(g_counter != 1){} /* wait until it finishes counting*/
-	Timer1_deInit(); /* de-initialize the timer */
-	g_counter = 0;
-
-	/* Prepare the LCD */
-	LCD_moveCursor(1,0);
-	LCD_displayString("locking   ");
-	/* set the compare value */
-	timer1_config.compare_value = 14648; /* for 15 sec */
-	/* Start the timer*/
-	Timer1_init(&timer1_config);
-	while(g_counter != 1){} /* wait until it finishes counting*/
-	Timer1_deInit(); /* de-initialize the timer */
-	g_counter = 0;
+	LCD_displayString("End of log");
+	APP_delayMs(1000);
 }
 
 /*
  * Description:
- * take the password from user and check if it is matched with the fixed one for maximum 3 times.
+ * Read a user number of up to 3 digits from the keypad, then wait for the ENTER key.
+ * Return USER_NONE if it is too big or the link is down.
  */
-uint8 APP_checkPass(void)
+uint8 APP_readUser(void)
 {
-	/* Variable declaration */
-	uint8 a_counter = 0, a_checkPass = 'F';
-	/* loop until the password matches with the fixed one or the counter reaches 3.*/
-	while(a_checkPass != 'S')
+	uint16 a_user = 0;
+	uint8 a_digits = 0, a_key;
+
+	while(1)
 	{
-		if (a_counter == 3)
+		a_key = KEYPAD_getPressedKey();
+		if(a_key == KEYPAD_NO_KEY)
+			return USER_NONE;
+		if((a_key == 13) && (a_digits != 0))
 			break;
-		UART_sendByte(CHECK_PASS); /* Tell the control ECU to be ready for comparing the passwords */
-		APP_getPassFromUser(); /* user enters the password*/
-		a_checkPass = UART_recieveByte();
-		a_counter++;
+		if((a_key >= '0') && (a_key <= '9') && (a_digits < 3))
+		{
+			a_user = a_user * 10 + (a_key - '0');
+			LCD_displayCharacter(a_key);
+			a_digits++;
+		}
+		APP_delayMs(500); /* time of press */
 	}
-	if (a_checkPass == 'F') /* the loop breaks due to break (counter = 3)*/
-		return FAILED;
-	return SUCCEED;
+	return (a_user < USER_NONE) ? a_user : USER_NONE;
 }
 
 /*
  * Description:
- * Display on LCD "INCORRECT PASS" while the buzzer is on for 1 min.
+ * Take the operation and the password, then a new PIN twice or a user number,
+ * and send them to the selected door in one request.
+ * + : add a user, - : remove a user, * : disable a user, % : enable a user again
  */
-void APP_alarm(void)
+void APP_manageUsers(void)
 {
-	Timer1_ConfigType timer1_config = {0, 58593, F_CPU_1024, COMPARE_MODE}; /* Timer configurations */
-	Timer1_setCallBack(APP_timerCounter); /* Set the callback function */
-	/* Prepare the LCD */
+	uint8 a_request[3 * PASS_LENGTH], a_choice, a_result;
+
 	LCD_clearScreen();
-	LCD_displayString("INCORRECT PASS");
-	UART_sendByte(INCORRECT_PASS); /* Announce the control ECU that we are in the state of incorrect password */
-	/* Start the timer*/
-	Timer1_init(&timer1_config);
-	while(g_counter != 1){} /* wait until it finishes counting*/
-	g_counter = 0;
-	Timer1_deInit(); /* de-initialize the timer */
-}
+	LCD_displayString("+:Add -:Remove");
+	LCD_moveCursor(1,0);
+	LCD_displayString("*:Off %:On");
+	APP_delayMs(500); /* time of press */
+	do
+		a_choice = KEYPAD_getPressedKey();
+	while((a_choice != '+') && (a_choice != '-') && (a_choice != '*') && (a_choice != '%')
+		  && (a_choice != KEYPAD_NO_KEY)); /* other than the options do nothing */
+	if(a_choice == KEYPAD_NO_KEY)
+		return;
+	APP_delayMs(500); /* time of press */
 
-/* Callback function of Timer1 */
-void APP_timerCounter(void)
-{
-	g_counter++;
+	if(!APP_getPassFromUser(a_request)) /* only the password manages the users */
+		return;
+	if(a_choice == '+')
+	{
+		if(!APP_getNewPass(&a_request[PASS_LENGTH])) /* the PIN of the new user */
+			return;
+		a_result = APP_request(USER_ADD, a_request, 3 * PASS_LENGTH, NULL_PTR);
+	}
+	else
+	{
+		LCD_clearScreen();
+		LCD_displayString("User number:");
+		LCD_moveCursor(1,0);
+		a_request[PASS_LENGTH] = APP_readUser();
+		if(!LINK_isUp())
+			return;
+		a_request[PASS_LENGTH + 1] = (a_choice == '-') ? USER_REMOVE :
+									 (a_choice == '*') ? USER_DISABLE : USER_ENABLE;
+		a_result = APP_request(USER_SET, a_request, PASS_LENGTH + 2, NULL_PTR);
+	}
+
+	LCD_clearScreen();
+	switch(a_result)
+	{
+	case RESULT_SUCCEED:
+		LCD_displayString("Done");
+		if(a_choice == '+')
+		{
+			LCD_moveCursor(1,0);
+			LCD_displayString("User ");
+			LCD_intgerToString(g_resultDetail);
+		}
+		break;
+	case RESULT_MISMATCH:
+		LCD_displayString("Not matched");
+		break;
+	case RESULT_REJECTED:
+		LCD_displayString((a_choice == '+') ? "PIN used or full" : "No such user");
+		break;
+	case RESULT_ALARM:
+		APP_alarm();
+		return;
+	case RESULT_NO_PASS:
+		APP_setupPass(); /* the control ECU restarted meanwhile */
+		return;
+	case RESULT_LINK_DOWN:
+		return;
+	default:
+		LCD_displayString("Wrong pass");
+		break;
+	}
+	APP_delayMs(2000);
 }
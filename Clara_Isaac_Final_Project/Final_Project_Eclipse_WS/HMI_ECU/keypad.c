@@ -13,6 +13,12 @@
 #include "gpio.h"
 #include <util/delay.h>
 
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static boolean (*g_idleCallBackPtr)(void) = NULL_PTR;
+
 /*******************************************************************************
  *                      Functions Prototypes(Private)                          *
  *******************************************************************************/
@@ -88,9 +94,24 @@ uint8 KEYPAD_getPressedKey(void)
 			}
 			GPIO_setupPinDirection(KEYPAD_ROW_PORT_ID,KEYPAD_FIRST_ROW_PIN_ID+row,PIN_INPUT);
 		}
+		/* No key is pressed, let the application serve its other tasks */
+		if((g_idleCallBackPtr != NULL_PTR) && !((*g_idleCallBackPtr)()))
+		{
+			return KEYPAD_NO_KEY;
+		}
 	}	
 }
 
+/*
+ * Description :
+ * Set a function called after every scan of the keypad while no key is pressed,
+ * if it returns FALSE KEYPAD_getPressedKey stops waiting and returns KEYPAD_NO_KEY.
+ */
+void KEYPAD_setIdleCallBack(boolean(*a_ptr)(void))
+{
+	g_idleCallBackPtr = a_ptr;
+}
+
 #ifndef STANDARD_KEYPAD
 
 #if (KEYPAD_NUM_COLS == 3)
@@ -34,6 +34,9 @@
 #define KEYPAD_BUTTON_PRESSED            LOGIC_LOW
 #define KEYPAD_BUTTON_RELEASED           LOGIC_HIGH
 
+/* Returned by KEYPAD_getPressedKey when the idle callback stops the wait */
+#define KEYPAD_NO_KEY                    0xFF
+
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
@@ -44,4 +47,11 @@
  */
 uint8 KEYPAD_getPressedKey(void);
 
+/*
+ * Description :
+ * Set a function called after every scan of the keypad while no key is pressed,
+ * if it returns FALSE KEYPAD_getPressedKey stops waiting and returns KEYPAD_NO_KEY.
+ */
+void KEYPAD_setIdleCallBack(boolean(*a_ptr)(void));
+
 #endif /* KEYPAD_H_ */
@@ -0,0 +1,653 @@
+/******************************************************************************
+ *
+ * Module: LINK
+ *
+ * File Name: link.c
+ *
+ * Description: Source file for the framed protocol between the HMI and Control ECUs
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "link.h"
+#include "uart.h"
+#include "crc.h"
+#include "tick.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* SYNC + DESTINATION + SOURCE + TYPE + LENGTH + CRC */
+#define LINK_OVERHEAD         6
+#define LINK_HEADER_SIZE      5
+#define LINK_MAX_FRAME        (LINK_MAX_PAYLOAD + LINK_OVERHEAD)
+
+/* Pages of the LINK_STATS_REQUEST diagnostic command */
+#define LINK_STATS_PAGE_UART  0
+#define LINK_STATS_PAGE_LINK  1
+#define LINK_STATS_UART_LENGTH (1 + 2 * 6)
+#define LINK_STATS_LINK_LENGTH (1 + 2 * 4)
+
+/* Time for the other ECU to finish sending LINK_BAUD_ACCEPT and switch its rate */
+#define LINK_SWITCH_GUARD_MS  2
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/*
+ * Bytes of the frame being received, kept between calls so frames can arrive in pieces.
+ * If a candidate frame turns out to be corrupted, the parser searches these bytes for
+ * the next SYNC, so a frame that follows the noise directly is not lost.
+ */
+static uint8 g_rxRaw[LINK_MAX_FRAME];
+static uint8 g_rxCount = 0;
+
+/* Address of this node and of the node it talks to */
+static uint8 g_ownAddress = LINK_HMI_ADDRESS;
+static uint8 g_peerAddress = LINK_HMI_ADDRESS;
+
+/* Time of the last valid frame from the peer and of the last heartbeat sent */
+static uint32 g_lastRxTime = 0;
+static uint32 g_heartbeatTime = 0;
+
+/* Frame counters */
+static LINK_Stats g_stats = {0, 0, 0, 0};
+
+/* Rate switched to by a LINK_BAUD_PROPOSE and still waiting for LINK_BAUD_CONFIRM */
+static boolean g_baudPending = FALSE;
+static uint32 g_baudSwitchTime = 0;
+
+/* Known pattern sent in LINK_TEST frames, it includes the SYNC byte and alternating bits */
+static const uint8 g_testPattern[LINK_MAX_PAYLOAD] = {
+	0x00, 0x00, LINK_SYNC_BYTE, 0x00, 0xFF, 0x55, 0xAA, 0x0F,
+	0xF0, 0x01, 0x80, 0x33, 0xCC, 0x7D, 0x81, 0xFE
+};
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Drop the first n bytes of the receive buffer.
+ */
+static void LINK_dropBytes(uint8 n);
+
+/*
+ * Description :
+ * Search the receive buffer for a complete valid frame.
+ */
+static boolean LINK_parseBuffer(LINK_Frame *frame);
+
+/*
+ * Description :
+ * Return TRUE once a complete valid frame of any type is received.
+ */
+static boolean LINK_receiveAnyFrame(LINK_Frame *frame);
+
+/*
+ * Description :
+ * Change the UART rate and drop the bytes of a partly received frame.
+ */
+static void LINK_changeBaud(UART_BaudRate baud_rate);
+
+/*
+ * Description :
+ * Answer the link management frames sent by the HMI ECU.
+ */
+static void LINK_handleManagement(const LINK_Frame *frame);
+
+/*
+ * Description :
+ * Wait for the given time while dropping any received frame.
+ */
+static void LINK_waitMs(uint16 ms);
+
+/*
+ * Description :
+ * Broadcast LINK_BAUD_RESET at every supported rate and go back to the default one.
+ */
+static void LINK_resetBaud(void);
+
+/*
+ * Description :
+ * Run LINK_TEST_ROUNDS echo tests at the current rate, return TRUE if all of them pass.
+ */
+static boolean LINK_testLink(UART_BaudRate baud_rate);
+
+/*
+ * Description :
+ * Answer a LINK_STATS_REQUEST with the counters of the requested page.
+ */
+static void LINK_sendStats(const LINK_Frame *frame);
+
+/*
+ * Description :
+ * Read a 16-bit little endian counter from a payload.
+ */
+static uint16 LINK_getCounter(const uint8 *payload, uint8 index);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Set the address of this node and of the node it talks to,
+ * and enable the hardware address filtering of the UART.
+ */
+void LINK_init(uint8 own_address, uint8 peer_address)
+{
+	g_ownAddress = own_address;
+	g_peerAddress = peer_address;
+	g_rxCount = 0;
+	g_lastRxTime = TICK_getMs();
+	UART_setAddress(own_address);
+}
+
+/*
+ * Description :
+ * Change the node this one talks to (the door selected by the HMI ECU),
+ * the new peer has LINK_DEAD_MS to answer before the link is down.
+ */
+void LINK_setPeer(uint8 peer_address)
+{
+	g_peerAddress = peer_address;
+	g_lastRxTime = TICK_getMs();
+}
+
+/*
+ * Description :
+ * Send one frame with the given type and payload to the peer node.
+ */
+void LINK_sendFrame(uint8 type, const uint8 *payload, uint8 length)
+{
+	LINK_sendFrameTo(g_peerAddress, type, payload, length);
+}
+
+/*
+ * Description :
+ * Send one frame with the given type and payload to any node or to LINK_BROADCAST_ADDRESS.
+ */
+void LINK_sendFrameTo(uint8 destination, uint8 type, const uint8 *payload, uint8 length)
+{
+	uint8 i, crc = CRC8_INIT;
+
+	if(length > LINK_MAX_PAYLOAD)
+		return;
+
+	/* Wake up the destination only, the other nodes drop the frame in hardware */
+	UART_sendAddress(destination);
+	UART_sendByte(LINK_SYNC_BYTE);
+	UART_sendByte(destination);
+	crc = CRC_update8(crc, destination);
+	UART_sendByte(g_ownAddress);
+	crc = CRC_update8(crc, g_ownAddress);
+	UART_sendByte(type);
+	crc = CRC_update8(crc, type);
+	UART_sendByte(length);
+	crc = CRC_update8(crc, length);
+	for(i = 0; i < length; i++)
+	{
+		UART_sendByte(payload[i]);
+		crc = CRC_update8(crc, payload[i]);
+	}
+	UART_sendByte(crc);
+	g_stats.tx_frames++;
+}
+
+/*
+ * Description :
+ * Non-blocking receive, parse the bytes received so far and return TRUE
+ * once a complete frame with a valid CRC is in frame.
+ * Corrupted or too long frames are dropped and the parser hunts for the next SYNC byte.
+ * Only frames from the peer node to this node (or broadcast) are returned.
+ */
+boolean LINK_receiveFrame(LINK_Frame *frame)
+{
+	/* A proposed rate that is never confirmed means the HMI ECU went back to the default one */
+	if(g_baudPending && (TICK_elapsedMs(g_baudSwitchTime) > LINK_BAUD_CONFIRM_MS))
+	{
+		g_baudPending = FALSE;
+		LINK_changeBaud(LINK_DEFAULT_BAUD);
+	}
+
+	LINK_heartbeatTask();
+	while(LINK_receiveAnyFrame(frame))
+	{
+		if(frame->type > LINK_LAST_MANAGEMENT_TYPE)
+			return TRUE;
+		LINK_handleManagement(frame);
+	}
+	return FALSE;
+}
+
+/*
+ * Description :
+ * Wait until a complete valid frame is received, return FALSE if the link goes down first.
+ */
+boolean LINK_waitFrame(LINK_Frame *frame)
+{
+	while(!LINK_receiveFrame(frame))
+	{
+		if(!LINK_isUp())
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Send the heartbeat frames when they are due (HMI ECU only),
+ * it is called by LINK_receiveFrame so it runs while the application serves the link.
+ */
+void LINK_heartbeatTask(void)
+{
+	if((g_ownAddress != LINK_HMI_ADDRESS) || (TICK_elapsedMs(g_heartbeatTime) < LINK_HEARTBEAT_MS))
+		return;
+
+	g_heartbeatTime = TICK_getMs();
+	/* The doors that are not selected only need to know the HMI ECU is alive */
+	LINK_sendFrameTo(LINK_BROADCAST_ADDRESS, LINK_HEARTBEAT, NULL_PTR, 0);
+	LINK_sendFrame(LINK_HEARTBEAT, NULL_PTR, 0);
+}
+
+/*
+ * Description :
+ * Return TRUE if a valid frame came from the peer node within LINK_DEAD_MS.
+ */
+boolean LINK_isUp(void)
+{
+	return TICK_elapsedMs(g_lastRxTime) < LINK_DEAD_MS;
+}
+
+/*
+ * Description :
+ * Send a request and wait up to LINK_REPLY_TIMEOUT_MS for a frame of reply_type,
+ * the request is sent again up to retries times.
+ * Other frames received meanwhile are dropped.
+ * Return TRUE if the reply is received in reply.
+ */
+boolean LINK_request(uint8 type, const uint8 *payload, uint8 length,
+					 uint8 reply_type, LINK_Frame *reply, uint8 retries)
+{
+	uint8 attempt;
+	uint32 start;
+
+	for(attempt = 0; attempt <= retries; attempt++)
+	{
+		if(attempt != 0)
+			g_stats.retries++;
+		LINK_sendFrame(type, payload, length);
+		start = TICK_getMs();
+		while(TICK_elapsedMs(start) < LINK_REPLY_TIMEOUT_MS)
+		{
+			if(LINK_receiveAnyFrame(reply) && (reply->type == reply_type))
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Description :
+ * Startup handshake, called by the HMI ECU only, the bus has one rate for all nodes:
+ * 1. Broadcast LINK_BAUD_RESET at every supported rate, so all nodes go back to the default rate.
+ * 2. Starting from the fastest rate, propose it to every node, switch to it and run
+ *    LINK_TEST_ROUNDS echo tests with every node.
+ * 3. Confirm the first rate that passes with all nodes, on any failure go back to step 1.
+ * Return the rate in use at the end.
+ */
+UART_BaudRate LINK_negotiateBaud(const uint8 nodes[], uint8 nodes_num)
+{
+	uint8 rate, node;
+	boolean passed;
+	LINK_Frame a_reply;
+	uint8 peer = g_peerAddress;
+
+	LINK_resetBaud();
+	for(rate = UART_BAUD_RATES_NUM - 1; rate > LINK_DEFAULT_BAUD; rate--)
+	{
+		/* Every node answers the proposal at the default rate, then switches */
+		passed = TRUE;
+		for(node = 0; passed && (node < nodes_num); node++)
+		{
+			g_peerAddress = nodes[node];
+			passed = LINK_request(LINK_BAUD_PROPOSE, &rate, 1, LINK_BAUD_ACCEPT, &a_reply, LINK_REQUEST_RETRIES)
+					 && (a_reply.payload[0] == rate);
+		}
+		if(passed)
+		{
+			LINK_changeBaud(rate);
+			LINK_waitMs(LINK_SWITCH_GUARD_MS);
+		}
+		/* Confirm only when every node passed the test, a half confirmed bus is never left */
+		for(node = 0; passed && (node < nodes_num); node++)
+		{
+			g_peerAddress = nodes[node];
+			passed = LINK_testLink(rate);
+		}
+		for(node = 0; passed && (node < nodes_num); node++)
+		{
+			g_peerAddress = nodes[node];
+			passed = LINK_request(LINK_BAUD_CONFIRM, &rate, 1, LINK_BAUD_CONFIRMED, &a_reply, LINK_REQUEST_RETRIES);
+		}
+		if(passed)
+		{
+			g_peerAddress = peer;
+			return rate;
+		}
+		LINK_resetBaud();
+	}
+	g_peerAddress = peer;
+	return LINK_DEFAULT_BAUD;
+}
+
+/*
+ * Description :
+ * Copy the frame counters of this node.
+ */
+void LINK_getStats(LINK_Stats *stats)
+{
+	*stats = g_stats;
+}
+
+/*
+ * Description :
+ * Diagnostic command, read the UART and frame counters of the peer node.
+ * Return FALSE if the peer does not answer.
+ */
+boolean LINK_requestStats(UART_Stats *uart_stats, LINK_Stats *link_stats)
+{
+	uint8 page = LINK_STATS_PAGE_UART;
+	LINK_Frame a_reply;
+
+	/* The counters don't fit in one frame, they are read in 2 pages */
+	if(!LINK_request(LINK_STATS_REQUEST, &page, 1, LINK_STATS_REPLY, &a_reply, LINK_REQUEST_RETRIES)
+	   || (a_reply.length != LINK_STATS_UART_LENGTH) || (a_reply.payload[0] != page))
+		return FALSE;
+	uart_stats->rx_bytes = LINK_getCounter(a_reply.payload, 0);
+	uart_stats->tx_bytes = LINK_getCounter(a_reply.payload, 1);
+	uart_stats->overruns = LINK_getCounter(a_reply.payload, 2);
+	uart_stats->framing_errors = LINK_getCounter(a_reply.payload, 3);
+	uart_stats->parity_errors = LINK_getCounter(a_reply.payload, 4);
+	uart_stats->rx_dropped = LINK_getCounter(a_reply.payload, 5);
+
+	page = LINK_STATS_PAGE_LINK;
+	if(!LINK_request(LINK_STATS_REQUEST, &page, 1, LINK_STATS_REPLY, &a_reply, LINK_REQUEST_RETRIES)
+	   || (a_reply.length != LINK_STATS_LINK_LENGTH) || (a_reply.payload[0] != page))
+		return FALSE;
+	link_stats->rx_frames = LINK_getCounter(a_reply.payload, 0);
+	link_stats->tx_frames = LINK_getCounter(a_reply.payload, 1);
+	link_stats->crc_errors = LINK_getCounter(a_reply.payload, 2);
+	link_stats->retries = LINK_getCounter(a_reply.payload, 3);
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Drop the first n bytes of the receive buffer.
+ */
+static void LINK_dropBytes(uint8 n)
+{
+	uint8 i;
+
+	for(i = n; i < g_rxCount; i++)
+	{
+		g_rxRaw[i - n] = g_rxRaw[i];
+	}
+	g_rxCount -= n;
+}
+
+/*
+ * Description :
+ * Search the receive buffer for a complete valid frame.
+ */
+static boolean LINK_parseBuffer(LINK_Frame *frame)
+{
+	uint8 i, crc, length;
+
+	while(g_rxCount != 0)
+	{
+		if(g_rxRaw[0] != LINK_SYNC_BYTE)
+		{
+			LINK_dropBytes(1);
+			continue;
+		}
+		if(g_rxCount < LINK_HEADER_SIZE)
+			return FALSE; /* wait for the header */
+
+		length = g_rxRaw[4];
+		if(length > LINK_MAX_PAYLOAD)
+		{
+			/* Can't be a valid frame, resynchronize from the next byte */
+			LINK_dropBytes(1);
+			continue;
+		}
+		if(g_rxCount < length + LINK_OVERHEAD)
+			return FALSE; /* wait for the rest of the frame */
+
+		crc = CRC_calculate8(&g_rxRaw[1], length + LINK_HEADER_SIZE - 1);
+		if(crc != g_rxRaw[length + LINK_HEADER_SIZE])
+		{
+			/* Corrupted frame, the real SYNC may be inside it */
+			g_stats.crc_errors++;
+			LINK_dropBytes(1);
+			continue;
+		}
+
+		frame->destination = g_rxRaw[1];
+		frame->source = g_rxRaw[2];
+		frame->type = g_rxRaw[3];
+		frame->length = length;
+		for(i = 0; i < length; i++)
+		{
+			frame->payload[i] = g_rxRaw[LINK_HEADER_SIZE + i];
+		}
+		LINK_dropBytes(length + LINK_OVERHEAD);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Description :
+ * Return TRUE once a complete valid frame of any type is received.
+ */
+static boolean LINK_receiveAnyFrame(LINK_Frame *frame)
+{
+	uint8 data;
+
+	while(UART_tryReceive(&data))
+	{
+		/* Bytes before the SYNC are noise */
+		if((g_rxCount == 0) && (data != LINK_SYNC_BYTE))
+			continue;
+		g_rxRaw[g_rxCount] = data;
+		g_rxCount++;
+		if(!LINK_parseBuffer(frame))
+			continue;
+		/* The UART filters the address bytes, check the protected header too */
+		if(((frame->destination == g_ownAddress) || (frame->destination == LINK_BROADCAST_ADDRESS))
+		   && (frame->source == g_peerAddress))
+		{
+			g_stats.rx_frames++;
+			g_lastRxTime = TICK_getMs();
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Description :
+ * Change the UART rate and drop the bytes of a partly received frame.
+ */
+static void LINK_changeBaud(UART_BaudRate baud_rate)
+{
+	UART_setBaudRate(baud_rate);
+	g_rxCount = 0;
+}
+
+/*
+ * Description :
+ * Answer the link management frames sent by the HMI ECU.
+ */
+static void LINK_handleManagement(const LINK_Frame *frame)
+{
+	switch(frame->type)
+	{
+	case LINK_BAUD_RESET:
+		g_baudPending = FALSE;
+		LINK_changeBaud(LINK_DEFAULT_BAUD);
+		break;
+	case LINK_BAUD_PROPOSE:
+		if((frame->length != 1) || (frame->payload[0] >= UART_BAUD_RATES_NUM))
+			break;
+		/* The answer is sent at the old rate, LINK_changeBaud waits until it is out */
+		LINK_sendFrameTo(frame->source, LINK_BAUD_ACCEPT, frame->payload, 1);
+		LINK_changeBaud(frame->payload[0]);
+		g_baudPending = TRUE;
+		g_baudSwitchTime = TICK_getMs();
+		break;
+	case LINK_TEST:
+		LINK_sendFrameTo(frame->source, LINK_TEST_ECHO, frame->payload, frame->length);
+		break;
+	case LINK_BAUD_CONFIRM:
+		g_baudPending = FALSE;
+		LINK_sendFrameTo(frame->source, LINK_BAUD_CONFIRMED, frame->payload, frame->length);
+		break;
+	case LINK_STATS_REQUEST:
+		LINK_sendStats(frame);
+		break;
+	case LINK_HEARTBEAT:
+		/* Only the selected door answers, the broadcast one would collide on the bus */
+		if((g_ownAddress != LINK_HMI_ADDRESS) && (frame->destination == g_ownAddress))
+			LINK_sendFrameTo(frame->source, LINK_HEARTBEAT, NULL_PTR, 0);
+		break;
+	}
+}
+
+/*
+ * Description :
+ * Wait for the given time while dropping any received frame.
+ */
+static void LINK_waitMs(uint16 ms)
+{
+	LINK_Frame a_frame;
+	uint32 start = TICK_getMs();
+
+	while(TICK_elapsedMs(start) < ms)
+	{
+		LINK_receiveAnyFrame(&a_frame);
+	}
+}
+
+/*
+ * Description :
+ * Run LINK_TEST_ROUNDS echo tests at the current rate, return TRUE if all of them pass.
+ */
+static boolean LINK_testLink(UART_BaudRate baud_rate)
+{
+	uint8 i, round, a_pattern[LINK_MAX_PAYLOAD];
+	LINK_Frame a_reply;
+
+	for(i = 0; i < LINK_MAX_PAYLOAD; i++)
+	{
+		a_pattern[i] = g_testPattern[i];
+	}
+	a_pattern[0] = baud_rate;
+
+	for(round = 0; round < LINK_TEST_ROUNDS; round++)
+	{
+		a_pattern[1] = round;
+		/* No retries, any lost or corrupted frame means this rate is not reliable */
+		if(!LINK_request(LINK_TEST, a_pattern, LINK_MAX_PAYLOAD, LINK_TEST_ECHO, &a_reply, 0))
+			return FALSE;
+		if(a_reply.length != LINK_MAX_PAYLOAD)
+			return FALSE;
+		for(i = 0; i < LINK_MAX_PAYLOAD; i++)
+		{
+			if(a_reply.payload[i] != a_pattern[i])
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Broadcast LINK_BAUD_RESET at every supported rate and go back to the default one.
+ */
+static void LINK_resetBaud(void)
+{
+	uint8 rate;
+
+	/* The nodes may still run at a rate from an earlier session */
+	for(rate = UART_BAUD_RATES_NUM; rate > 0; rate--)
+	{
+		LINK_changeBaud(rate - 1);
+		LINK_sendFrameTo(LINK_BROADCAST_ADDRESS, LINK_BAUD_RESET, NULL_PTR, 0);
+	}
+	LINK_changeBaud(LINK_DEFAULT_BAUD);
+	LINK_waitMs(LINK_REPLY_TIMEOUT_MS);
+}
+
+/*
+ * Description :
+ * Answer a LINK_STATS_REQUEST with the counters of the requested page.
+ */
+static void LINK_sendStats(const LINK_Frame *frame)
+{
+	uint8 i, a_payload[LINK_STATS_UART_LENGTH];
+	uint16 a_counters[6];
+	uint8 counters_num;
+	UART_Stats a_uartStats;
+
+	if(frame->length != 1)
+		return;
+
+	if(frame->payload[0] == LINK_STATS_PAGE_UART)
+	{
+		UART_getStats(&a_uartStats);
+		a_counters[0] = a_uartStats.rx_bytes;
+		a_counters[1] = a_uartStats.tx_bytes;
+		a_counters[2] = a_uartStats.overruns;
+		a_counters[3] = a_uartStats.framing_errors;
+		a_counters[4] = a_uartStats.parity_errors;
+		a_counters[5] = a_uartStats.rx_dropped;
+		counters_num = 6;
+	}
+	else if(frame->payload[0] == LINK_STATS_PAGE_LINK)
+	{
+		a_counters[0] = g_stats.rx_frames;
+		a_counters[1] = g_stats.tx_frames;
+		a_counters[2] = g_stats.crc_errors;
+		a_counters[3] = g_stats.retries;
+		counters_num = 4;
+	}
+	else
+	{
+		return;
+	}
+
+	a_payload[0] = frame->payload[0];
+	for(i = 0; i < counters_num; i++)
+	{
+		a_payload[1 + 2 * i] = (uint8)a_counters[i];
+		a_payload[2 + 2 * i] = (uint8)(a_counters[i] >> 8);
+	}
+	LINK_sendFrameTo(frame->source, LINK_STATS_REPLY, a_payload, 1 + 2 * counters_num);
+}
+
+/*
+ * Description :
+ * Read a 16-bit little endian counter from a payload.
+ */
+static uint16 LINK_getCounter(const uint8 *payload, uint8 index)
+{
+	return payload[1 + 2 * index] | ((uint16)payload[2 + 2 * index] << 8);
+}
@@ -0,0 +1,190 @@
+ /******************************************************************************
+ *
+ * Module: LINK
+ *
+ * File Name: link.h
+ *
+ * Description: Header file for the framed protocol between the HMI and Control ECUs
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include "std_types.h"
+#include "uart.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Frame format on the wire (9-bit characters, multi-drop bus):
+ * | ADDRESS | SYNC | DESTINATION | SOURCE | TYPE | LENGTH | PAYLOAD (LENGTH bytes) | CRC-8 |
+ * ADDRESS is the destination sent with the ninth bit set, the nodes that are not addressed
+ * drop the rest of the frame in hardware (MPCM).
+ * The CRC covers DESTINATION, SOURCE, TYPE, LENGTH and PAYLOAD.
+ */
+#define LINK_SYNC_BYTE        0x7E
+#define LINK_MAX_PAYLOAD      16
+
+/* The HMI ECU is the bus master, door controllers use the addresses from 1 */
+#define LINK_HMI_ADDRESS      0x00
+#define LINK_BROADCAST_ADDRESS UART_BROADCAST_ADDRESS
+
+/*
+ * Link management frame types (0x01 to 0x0F), they are handled inside this module
+ * and never returned to the application by LINK_receiveFrame.
+ */
+#define LINK_BAUD_RESET       0x01 /* go back to LINK_DEFAULT_BAUD, sent at every rate */
+#define LINK_BAUD_PROPOSE     0x02 /* payload: UART_BaudRate */
+#define LINK_BAUD_ACCEPT      0x03 /* payload: UART_BaudRate, sent before switching */
+#define LINK_TEST             0x04 /* payload: test pattern */
+#define LINK_TEST_ECHO        0x05 /* payload: the same test pattern */
+#define LINK_BAUD_CONFIRM     0x06 /* payload: UART_BaudRate */
+#define LINK_BAUD_CONFIRMED   0x07 /* payload: UART_BaudRate */
+#define LINK_STATS_REQUEST    0x08 /* payload: page */
+#define LINK_STATS_REPLY      0x09 /* payload: page + counters of the page, 16-bit little endian */
+#define LINK_HEARTBEAT        0x0A /* no payload, answered by the door when it is addressed to it */
+#define LINK_LAST_MANAGEMENT_TYPE 0x0F
+
+/* Rate used after reset and whenever the negotiation fails */
+#define LINK_DEFAULT_BAUD     BAUD_9600
+
+/* Time to wait for the reply of a request before sending it again */
+#define LINK_REPLY_TIMEOUT_MS 50
+#define LINK_REQUEST_RETRIES  3
+
+/* Echoed test frames that must all pass before a new rate is confirmed */
+#define LINK_TEST_ROUNDS      3
+
+/* A proposed rate that is not confirmed within this time is dropped for the default one */
+#define LINK_BAUD_CONFIRM_MS  500
+
+/*
+ * The HMI ECU sends a heartbeat every LINK_HEARTBEAT_MS, broadcast to keep all the doors alive
+ * and addressed to the selected door which answers it. The link is down when no valid frame
+ * came from the peer within LINK_DEAD_MS.
+ */
+#ifndef LINK_HEARTBEAT_MS
+#define LINK_HEARTBEAT_MS     100
+#endif
+#ifndef LINK_DEAD_MS
+#define LINK_DEAD_MS          350
+#endif
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+typedef struct{
+ uint8 destination;
+ uint8 source;
+ uint8 type;
+ uint8 length;
+ uint8 payload[LINK_MAX_PAYLOAD];
+}LINK_Frame;
+
+/* Frame counters, they wrap around at 65535 */
+typedef struct{
+ uint16 rx_frames; /* valid frames for this node */
+ uint16 tx_frames;
+ uint16 crc_errors; /* candidate frames dropped because of a wrong CRC */
+ uint16 retries; /* requests sent again because no reply came in time */
+}LINK_Stats;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Set the address of this node and of the node it talks to,
+ * and enable the hardware address filtering of the UART.
+ */
+void LINK_init(uint8 own_address, uint8 peer_address);
+
+/*
+ * Description :
+ * Change the node this one talks to (the door selected by the HMI ECU),
+ * the new peer has LINK_DEAD_MS to answer before the link is down.
+ */
+void LINK_setPeer(uint8 peer_address);
+
+/*
+ * Description :
+ * Send one frame with the given type and payload to the peer node.
+ */
+void LINK_sendFrame(uint8 type, const uint8 *payload, uint8 length);
+
+/*
+ * Description :
+ * Send one frame with the given type and payload to any node or to LINK_BROADCAST_ADDRESS.
+ */
+void LINK_sendFrameTo(uint8 destination, uint8 type, const uint8 *payload, uint8 length);
+
+/*
+ * Description :
+ * Non-blocking receive, parse the bytes received so far and return TRUE
+ * once a complete frame with a valid CRC is in frame.
+ * Corrupted or too long frames are dropped and the parser hunts for the next SYNC byte.
+ * Only frames from the peer node to this node (or broadcast) are returned.
+ */
+boolean LINK_receiveFrame(LINK_Frame *frame);
+
+/*
+ * Description :
+ * Wait until a complete valid frame is received, return FALSE if the link goes down first.
+ */
+boolean LINK_waitFrame(LINK_Frame *frame);
+
+/*
+ * Description :
+ * Send the heartbeat frames when they are due (HMI ECU only),
+ * it is called by LINK_receiveFrame so it runs while the application serves the link.
+ */
+void LINK_heartbeatTask(void);
+
+/*
+ * Description :
+ * Return TRUE if a valid frame came from the peer node within LINK_DEAD_MS.
+ */
+boolean LINK_isUp(void);
+
+/*
+ * Description :
+ * Send a request and wait up to LINK_REPLY_TIMEOUT_MS for a frame of reply_type,
+ * the request is sent again up to retries times.
+ * Other frames received meanwhile are dropped.
+ * Return TRUE if the reply is received in reply.
+ */
+boolean LINK_request(uint8 type, const uint8 *payload, uint8 length,
+					 uint8 reply_type, LINK_Frame *reply, uint8 retries);
+
+/*
+ * Description :
+ * Startup handshake, called by the HMI ECU only, the bus has one rate for all nodes:
+ * 1. Broadcast LINK_BAUD_RESET at every supported rate, so all nodes go back to the default rate.
+ * 2. Starting from the fastest rate, propose it to every node, switch to it and run
+ *    LINK_TEST_ROUNDS echo tests with every node.
+ * 3. Confirm the first rate that passes with all nodes, on any failure go back to step 1.
+ * Return the rate in use at the end.
+ */
+UART_BaudRate LINK_negotiateBaud(const uint8 nodes[], uint8 nodes_num);
+
+/*
+ * Description :
+ * Copy the frame counters of this node.
+ */
+void LINK_getStats(LINK_Stats *stats);
+
+/*
+ * Description :
+ * Diagnostic command, read the UART and frame counters of the peer node.
+ * Return FALSE if the peer does not answer.
+ */
+boolean LINK_requestStats(UART_Stats *uart_stats, LINK_Stats *link_stats);
+
+#endif /* LINK_H_ */
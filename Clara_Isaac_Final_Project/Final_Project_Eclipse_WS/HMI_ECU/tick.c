@@ -0,0 +1,85 @@
+/******************************************************************************
+ *
+ * Module: Tick
+ *
+ * File Name: tick.c
+ *
+ * Description: Source file for the 1 ms system tick based on Timer2
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "tick.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* Timer2 runs at F_CPU/64, so it counts (F_CPU/64000) times every 1 ms */
+#define TICK_COMPARE_VALUE ((F_CPU / 64000UL) - 1)
+
+#if (TICK_COMPARE_VALUE > 255)
+#error "F_CPU is too high for the 1 ms Timer2 tick"
+#endif
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static volatile uint32 g_ticks = 0;
+
+/*******************************************************************************
+ *                       Interrupt Service Routines                            *
+ *******************************************************************************/
+
+ISR(TIMER2_COMP_vect)
+{
+	g_ticks++;
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description:
+ * Start Timer2 in CTC mode with an interrupt every 1 ms.
+ */
+void TICK_init(void)
+{
+	TCNT2 = 0;
+	OCR2 = TICK_COMPARE_VALUE;
+	/* Enable Timer2 compare interrupt */
+	TIMSK |= (1<<OCIE2);
+	/* Configure timer control register TCCR2
+	 * 1. Non PWM mode FOC2 = 1
+	 * 2. CTC Mode WGM21 = 1 & WGM20 = 0
+	 * 3. Normal port operation, OC2 disconnected
+	 * 4. Prescaler = F_CPU/64 CS22 = 1 CS21 = 0 CS20 = 0
+	 */
+	TCCR2 = (1<<FOC2) | (1<<WGM21) | (1<<CS22);
+}
+
+/*
+ * Description:
+ * Return the number of milliseconds since TICK_init.
+ */
+uint32 TICK_getMs(void)
+{
+	uint32 ticks;
+	uint8 sreg = SREG;
+
+	/* The 4 bytes must be read without the ISR changing them in the middle */
+	cli();
+	ticks = g_ticks;
+	SREG = sreg;
+	return ticks;
+}
+
+/*
+ * Description:
+ * Return the number of milliseconds passed since the given start time.
+ */
+uint32 TICK_elapsedMs(uint32 start)
+{
+	return TICK_getMs() - start;
+}
@@ -11,9 +11,133 @@
  *******************************************************************************/
 
 #include "uart.h"
-#include "avr/io.h" /* To use the UART Registers */
+#include <avr/io.h> /* To use the UART Registers */
+#include <avr/interrupt.h> /* For UART ISRs */
 #include "common_macros.h" /* To use the macros like SET_BIT */
 
+#if ((UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) != 0) || (UART_RX_BUFFER_SIZE > 128)
+#error "UART_RX_BUFFER_SIZE must be a power of two and not more than 128"
+#endif
+#if ((UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) != 0) || (UART_TX_BUFFER_SIZE > 128)
+#error "UART_TX_BUFFER_SIZE must be a power of two and not more than 128"
+#endif
+
+#define UART_RX_BUFFER_MASK (UART_RX_BUFFER_SIZE - 1)
+#define UART_TX_BUFFER_MASK (UART_TX_BUFFER_SIZE - 1)
+
+/* UBRR value for double speed mode (U2X = 1), rounded to the nearest integer at compile time */
+#define UART_UBRR(BAUD) (((F_CPU) + 4UL * (BAUD)) / (8UL * (BAUD)) - 1UL)
+
+/* Real baud rate generated by a UBRR value, used to check the rate error at compile time */
+#define UART_REAL_BAUD(BAUD) ((F_CPU) / (8UL * (UART_UBRR(BAUD) + 1UL)))
+
+/* TRUE if the generated baud rate is within 2% of the required one */
+#define UART_BAUD_IS_VALID(BAUD) ((UART_REAL_BAUD(BAUD) * 100UL >= (BAUD) * 98UL) && \
+								  (UART_REAL_BAUD(BAUD) * 100UL <= (BAUD) * 102UL))
+
+#if !UART_BAUD_IS_VALID(9600) || !UART_BAUD_IS_VALID(19200) || !UART_BAUD_IS_VALID(38400) || \
+	!UART_BAUD_IS_VALID(76800) || !UART_BAUD_IS_VALID(250000) || !UART_BAUD_IS_VALID(500000) || \
+	!UART_BAUD_IS_VALID(1000000)
+#error "A baud rate in the UBRR table is not reachable within 2% with this F_CPU"
+#endif
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static volatile UART_Mode g_mode = POLLING_MODE;
+
+/* UBRR values indexed by UART_BaudRate, no division is done on the target */
+static const uint16 g_ubrrTable[UART_BAUD_RATES_NUM] = {
+	UART_UBRR(9600), UART_UBRR(19200), UART_UBRR(38400), UART_UBRR(76800),
+	UART_UBRR(250000), UART_UBRR(500000), UART_UBRR(1000000)
+};
+
+/* RX ring buffer: head is written by the ISR only, tail by the application only */
+static volatile uint8 g_rxBuffer[UART_RX_BUFFER_SIZE];
+static volatile uint8 g_rxHead = 0;
+static volatile uint8 g_rxTail = 0;
+
+/* TX ring buffer: head is written by the application only, tail by the ISR only */
+static volatile uint8 g_txBuffer[UART_TX_BUFFER_SIZE];
+static volatile uint8 g_txHead = 0;
+static volatile uint8 g_txTail = 0;
+
+/* TRUE once a byte is written to UDR, TXC means nothing before that */
+static volatile boolean g_txStarted = FALSE;
+
+/* Link quality counters, written by the ISRs in the interrupt mode */
+static volatile UART_Stats g_stats;
+
+/* Multi-processor communication mode */
+static boolean g_nineBit = FALSE;
+static volatile uint8 g_address = UART_NO_ADDRESS;
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Apply the address filtering on a received byte, return TRUE if it is a data byte
+ * for this node. MPCM is written with the whole UCSRA so the TXC flag is never cleared here.
+ */
+static boolean UART_filterAddress(uint8 ninth_bit, uint8 data);
+
+/*
+ * Description :
+ * Count the receive errors flagged in UCSRA, it must be read before UDR.
+ */
+static void UART_countErrors(uint8 status);
+
+/*******************************************************************************
+ *                       Interrupt Service Routines                            *
+ *******************************************************************************/
+
+ISR(USART_RXC_vect)
+{
+	/*
+	 * The error flags and RXB8 must be read before UDR, reading UDR clears the RXC flag,
+	 * it must be read even if the buffer is full
+	 */
+	uint8 status = UCSRA;
+	uint8 ninth_bit = BIT_IS_SET(UCSRB,RXB8);
+	uint8 data = UDR;
+	uint8 next = (g_rxHead + 1) & UART_RX_BUFFER_MASK;
+
+	UART_countErrors(status);
+	if(!UART_filterAddress(ninth_bit, data))
+		return;
+
+	/* Drop the byte if the buffer is full, the application is too slow */
+	if(next != g_rxTail)
+	{
+		g_rxBuffer[g_rxHead] = data;
+		g_rxHead = next;
+	}
+	else
+	{
+		g_stats.rx_dropped++;
+	}
+}
+
+ISR(USART_UDRE_vect)
+{
+	if(g_txHead != g_txTail)
+	{
+		SET_BIT(UCSRA,TXC); /* clear the TX complete flag, it is used by UART_flush */
+		UDR = g_txBuffer[g_txTail];
+		g_txStarted = TRUE;
+		g_stats.tx_bytes++;
+		g_txTail = (g_txTail + 1) & UART_TX_BUFFER_MASK;
+	}
+	else
+	{
+		/* Nothing left to send, disable the interrupt until the next byte is queued */
+		CLEAR_BIT(UCSRB,UDRIE);
+	}
+}
+
 /*******************************************************************************
  *                      Functions Definitions                                  *
  *******************************************************************************/
@@ -24,24 +148,38 @@
  * 1. Setup the Frame format like number of data bits, parity bit type and number of stop bits.
  * 2. Enable the UART.
  * 3. Setup the UART baud rate.
+ * 4. In the interrupt mode, reset the ring buffers and enable the RX Complete interrupt.
  */
 void UART_init(const UART_ConfigType * Config_Ptr)
 {
-	uint16 ubrr_value = 0;
+	g_mode = Config_Ptr->mode;
+	g_rxHead = 0;
+	g_rxTail = 0;
+	g_txHead = 0;
+	g_txTail = 0;
+	g_txStarted = FALSE;
+	g_nineBit = (Config_Ptr->bit_data == NINE_BIT);
+	g_address = UART_NO_ADDRESS;
+	UART_resetStats();
 
 	/* U2X = 1 for double transmission speed */
 	UCSRA = (1<<U2X);
 
 	/************************** UCSRB Description **************************
-	 * RXCIE = 0 Disable USART RX Complete Interrupt Enable
+	 * RXCIE = 1 in interrupt mode, Enable USART RX Complete Interrupt
 	 * TXCIE = 0 Disable USART Tx Complete Interrupt Enable
-	 * UDRIE = 0 Disable USART Data Register Empty Interrupt Enable
+	 * UDRIE = 0 Disable USART Data Register Empty Interrupt Enable,
+	 *         it is enabled only while the TX buffer has data
 	 * RXEN  = 1 Receiver Enable
 	 * RXEN  = 1 Transmitter Enable
 	 * UCSZ2 = 0 For 8-bit data mode
-	 * RXB8 & TXB8 not used for 8-bit data mode
-	 ***********************************************************************/ 
+	 * RXB8 & TXB8 not used for 8-bit data mode, TXB8 = 0 for data bytes in 9-bit mode
+	 ***********************************************************************/
 	UCSRB = (1<<RXEN) | (1<<TXEN);
+	if(g_mode == INTERRUPT_MODE)
+	{
+		SET_BIT(UCSRB,RXCIE);
+	}
 
 	/************************** UCSRC Description **************************
 	 * URSEL   = 1 The URSEL must be one when writing the UCSRC
@@ -53,37 +191,52 @@ void UART_init(const UART_ConfigType * Config_Ptr)
 	 ***********************************************************************/
 	UCSRC = (1<<URSEL)  | ((Config_Ptr->parity & 0x03) << 4)
 				    	| ((Config_Ptr->stop_bit)<< 3)
-						| ((Config_Ptr->bit_data & 0x03) << 1);
+				    	| ((Config_Ptr->bit_data & 0x03) << 1);
 
 	/************************** UCSRB Description **************************
 	 * UCSZ2   = 1 for 9 bit mode, 0 otherwise.
 	 ***********************************************************************/
 	UCSRB = (UCSRB & 0xFB) | ((Config_Ptr->bit_data) & 0x04);
-	/* Calculate the UBRR register value */
-	ubrr_value = (uint16)(((F_CPU / (Config_Ptr->baud_rate * 8UL))) - 1);
 
-	/* First 8 bits from the BAUD_PRESCALE inside UBRRL and last 4 bits in UBRRH*/
-	UBRRH = ubrr_value>>8;
-	UBRRL = ubrr_value;
+	/* Get the UBRR register value from the compile time table */
+	UART_setBaudRate(Config_Ptr->baud_rate);
 }
 
 /*
  * Description :
  * Functional responsible for send byte to another UART device.
+ * In the interrupt mode it only waits if the TX ring buffer is full.
  */
 void UART_sendByte(const uint8 data)
 {
+	uint8 next;
+
+	if(g_mode == INTERRUPT_MODE)
+	{
+		next = (g_txHead + 1) & UART_TX_BUFFER_MASK;
+		/* Wait until the ISR makes room in the TX buffer */
+		while(next == g_txTail){}
+		g_txBuffer[g_txHead] = data;
+		g_txHead = next;
+		/* UDRE interrupt will move the byte to UDR as soon as it is empty */
+		SET_BIT(UCSRB,UDRIE);
+		return;
+	}
+
 	/*
 	 * UDRE flag is set when the Tx buffer (UDR) is empty and ready for
 	 * transmitting a new byte so wait until this flag is set to one
 	 */
 	while(BIT_IS_CLEAR(UCSRA,UDRE)){}
 
+	SET_BIT(UCSRA,TXC); /* clear the TX complete flag, it is used by UART_flush */
 	/*
 	 * Put the required data in the UDR register and it also clear the UDRE flag as
 	 * the UDR register is not empty now
 	 */
 	UDR = data;
+	g_txStarted = TRUE;
+	g_stats.tx_bytes++;
 
 	/************************* Another Method *************************
 	UDR = data;
@@ -95,12 +248,23 @@ void UART_sendByte(const uint8 data)
 /*
  * Description :
  * Functional responsible for receive byte from another UART device.
+ * In the interrupt mode it waits until the RX ring buffer has a byte.
  */
 uint8 UART_recieveByte(void)
 {
+	uint8 data;
+
+	if((g_mode == INTERRUPT_MODE) || (g_address != UART_NO_ADDRESS))
+	{
+		while(!UART_tryReceive(&data)){}
+		return data;
+	}
+
 	/* RXC flag is set when the UART receive data so wait until this flag is set to one */
 	while(BIT_IS_CLEAR(UCSRA,RXC)){}
 
+	/* The error flags belong to the byte in UDR, they must be read first */
+	UART_countErrors(UCSRA);
 	/*
 	 * Read the received data from the Rx buffer (UDR)
 	 * The RXC flag will be cleared after read the data
@@ -127,7 +291,7 @@ void UART_sendString(const uint8 *Str)
 	{
 		UART_sendByte(*Str);
 		Str++;
-	}		
+	}
 	 *******************************************************************/
 }
 
@@ -152,3 +316,226 @@ void UART_receiveString(uint8 *Str)
 	/* After receiving the whole string plus the '#', replace the '#' with '\0' */
 	Str[i] = '\0';
 }
+
+/*
+ * Description :
+ * Non-blocking receive, returns TRUE and puts the byte in data if one is available,
+ * otherwise returns FALSE immediately.
+ */
+boolean UART_tryReceive(uint8 *data)
+{
+	uint8 ninth_bit;
+
+	if(g_mode == POLLING_MODE)
+	{
+		if(BIT_IS_CLEAR(UCSRA,RXC))
+			return FALSE;
+		UART_countErrors(UCSRA);
+		ninth_bit = BIT_IS_SET(UCSRB,RXB8);
+		*data = UDR;
+		return UART_filterAddress(ninth_bit, *data);
+	}
+
+	if(g_rxHead == g_rxTail)
+		return FALSE;
+	*data = g_rxBuffer[g_rxTail];
+	g_rxTail = (g_rxTail + 1) & UART_RX_BUFFER_MASK;
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Return the number of received bytes that are waiting to be read.
+ */
+uint8 UART_available(void)
+{
+	if(g_mode == POLLING_MODE)
+		return BIT_IS_SET(UCSRA,RXC) ? 1 : 0;
+
+	return (g_rxHead - g_rxTail) & UART_RX_BUFFER_MASK;
+}
+
+/*
+ * Description :
+ * Non-blocking send, queue as many bytes as the TX ring buffer can hold
+ * and return the number of queued bytes.
+ * In the polling mode it sends the whole array.
+ */
+uint8 UART_write(const uint8 *data, uint8 size)
+{
+	uint8 i, next;
+
+	if(g_mode == POLLING_MODE)
+	{
+		for(i = 0; i < size; i++)
+		{
+			UART_sendByte(data[i]);
+		}
+		return size;
+	}
+
+	for(i = 0; i < size; i++)
+	{
+		next = (g_txHead + 1) & UART_TX_BUFFER_MASK;
+		if(next == g_txTail)
+			break; /* buffer is full */
+		g_txBuffer[g_txHead] = data[i];
+		g_txHead = next;
+	}
+	if(i != 0)
+	{
+		SET_BIT(UCSRB,UDRIE);
+	}
+	return i;
+}
+
+/*
+ * Description :
+ * Wait until every queued byte has left the transmitter shift register.
+ */
+void UART_flush(void)
+{
+	/* Wait for the ISR to empty the TX buffer */
+	while(g_txHead != g_txTail){}
+	if(!g_txStarted)
+		return; /* nothing was ever sent */
+	/* Wait for the last byte in UDR to be shifted out, TXC is cleared with every new byte */
+	while(BIT_IS_CLEAR(UCSRA,UDRE)){}
+	while(BIT_IS_CLEAR(UCSRA,TXC)){}
+}
+
+/*
+ * Description :
+ * Change the baud rate after all queued bytes are sent, the frame format is kept.
+ */
+void UART_setBaudRate(UART_BaudRate baud_rate)
+{
+	uint16 ubrr_value;
+
+	if(baud_rate >= UART_BAUD_RATES_NUM)
+		return;
+	ubrr_value = g_ubrrTable[baud_rate];
+
+	UART_flush();
+	/* First 8 bits from the BAUD_PRESCALE inside UBRRL and last 4 bits in UBRRH*/
+	UBRRH = ubrr_value>>8;
+	UBRRL = ubrr_value;
+}
+
+/*
+ * Description :
+ * Enable the multi-processor communication mode filtering (NINE_BIT only),
+ * only the data bytes after this address or UART_BROADCAST_ADDRESS are received.
+ * UART_NO_ADDRESS disables the filtering.
+ */
+void UART_setAddress(uint8 address)
+{
+	if(!g_nineBit)
+		return;
+
+	g_address = address;
+	/* MPCM = 1 ignore the data bytes until an address byte for this node is received */
+	if(address == UART_NO_ADDRESS)
+		UCSRA = (1<<U2X);
+	else
+		UCSRA = (1<<U2X) | (1<<MPCM);
+}
+
+/*
+ * Description :
+ * Send an address byte (ninth bit set) that selects the node receiving the next data bytes.
+ * It does nothing if the frame format is not NINE_BIT.
+ */
+void UART_sendAddress(uint8 address)
+{
+	uint8 sreg;
+
+	if(!g_nineBit)
+		return;
+
+	/*
+	 * TXB8 is taken with the byte when it moves to the shift register, so wait until
+	 * the transmitter is completely empty, then the address byte moves there at once.
+	 */
+	UART_flush();
+	SET_BIT(UCSRB,TXB8);
+	/* The RX ISR writes MPCM, don't let it change UCSRA in the middle of this read-modify-write */
+	sreg = SREG;
+	cli();
+	SET_BIT(UCSRA,TXC); /* clear the TX complete flag, it is used by UART_flush */
+	SREG = sreg;
+	UDR = address;
+	g_txStarted = TRUE;
+	g_stats.tx_bytes++;
+	while(BIT_IS_CLEAR(UCSRA,UDRE)){}
+	CLEAR_BIT(UCSRB,TXB8);
+}
+
+/*
+ * Description :
+ * Apply the address filtering on a received byte, return TRUE if it is a data byte
+ * for this node. MPCM is written with the whole UCSRA so the TXC flag is never cleared here.
+ */
+static boolean UART_filterAddress(uint8 ninth_bit, uint8 data)
+{
+	if(g_address == UART_NO_ADDRESS)
+		return TRUE;
+
+	if(ninth_bit)
+	{
+		/* Address byte: receive the next data bytes only if they are for this node */
+		if((data == g_address) || (data == UART_BROADCAST_ADDRESS))
+			UCSRA = (1<<U2X);
+		else
+			UCSRA = (1<<U2X) | (1<<MPCM);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Copy the link quality counters counted since UART_init or UART_resetStats.
+ */
+void UART_getStats(UART_Stats *stats)
+{
+	uint8 sreg = SREG;
+
+	/* The counters are 16-bit and written by the ISRs, copy them all at once */
+	cli();
+	*stats = *(const UART_Stats *)&g_stats;
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Clear all the link quality counters.
+ */
+void UART_resetStats(void)
+{
+	uint8 sreg = SREG;
+
+	cli();
+	g_stats.rx_bytes = 0;
+	g_stats.tx_bytes = 0;
+	g_stats.overruns = 0;
+	g_stats.framing_errors = 0;
+	g_stats.parity_errors = 0;
+	g_stats.rx_dropped = 0;
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Count the receive errors flagged in UCSRA, it must be read before UDR.
+ */
+static void UART_countErrors(uint8 status)
+{
+	g_stats.rx_bytes++;
+	if(status & (1<<DOR))
+		g_stats.overruns++;
+	if(status & (1<<FE))
+		g_stats.framing_errors++;
+	if(status & (1<<PE))
+		g_stats.parity_errors++;
+}
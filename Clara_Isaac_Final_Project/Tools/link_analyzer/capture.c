@@ -0,0 +1,276 @@
+/******************************************************************************
+ *
+ * Module: CAPTURE
+ *
+ * File Name: capture.c
+ *
+ * Description: Source file for reading the HMI <-> Control link bytes from a
+ *              capture file or from two live serial ports / ptys
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "capture.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Return the monotonic time in microseconds.
+ */
+static uint64_t CAPTURE_nowUs(void);
+
+/*
+ * Description :
+ * Open one port in raw mode. Return the file descriptor or -1.
+ */
+static int CAPTURE_openPort(const char *path, long baud);
+
+/*
+ * Description :
+ * Return the termios speed of a baud rate, or B0 if the system has none.
+ */
+static speed_t CAPTURE_speed(long baud);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Open a capture file, "-" is the standard input. Return 0 on success.
+ */
+int CAPTURE_openFile(CAPTURE_Source *source, const char *path)
+{
+	memset(source, 0, sizeof(*source));
+	source->fd[0] = -1;
+	source->fd[1] = -1;
+	source->file = (strcmp(path, "-") == 0) ? stdin : fopen(path, "rb");
+	return (source->file != NULL) ? 0 : -1;
+}
+
+/*
+ * Description :
+ * Open the two ports that receive each direction of the link (a tap on the TX line of
+ * each ECU, or the ptys of the simulator) and set them to raw mode at the given baud rate,
+ * baud 0 keeps the port settings (a pty). Return 0 on success.
+ */
+int CAPTURE_openPorts(CAPTURE_Source *source, const char *hmi_tx_port,
+					  const char *control_tx_port, long baud)
+{
+	memset(source, 0, sizeof(*source));
+	source->fd[CAPTURE_DIR_HMI_TO_CONTROL] = CAPTURE_openPort(hmi_tx_port, baud);
+	source->fd[CAPTURE_DIR_CONTROL_TO_HMI] = CAPTURE_openPort(control_tx_port, baud);
+	if((source->fd[0] < 0) || (source->fd[1] < 0))
+	{
+		CAPTURE_close(source);
+		return -1;
+	}
+	source->start_us = CAPTURE_nowUs();
+	return 0;
+}
+
+/*
+ * Description :
+ * Get the next byte in time order.
+ * Return 1 if a record is read, 0 at the end of the capture and -1 on a read error.
+ * In the live mode it waits for the next byte until *stop is set.
+ */
+int CAPTURE_next(CAPTURE_Source *source, CAPTURE_Record *record, volatile int *stop)
+{
+	uint8_t raw[CAPTURE_RECORD_SIZE];
+	uint32_t raw_us;
+	struct pollfd fds[CAPTURE_DIRECTIONS];
+	int dir, chosen;
+	ssize_t count;
+	uint64_t now;
+
+	if(source->file != NULL)
+	{
+		if(fread(raw, 1, CAPTURE_RECORD_SIZE, source->file) != CAPTURE_RECORD_SIZE)
+			return ferror(source->file) ? -1 : 0;
+		raw_us = raw[0] | ((uint32_t)raw[1] << 8) | ((uint32_t)raw[2] << 16) | ((uint32_t)raw[3] << 24);
+		/* The recorder counter is 32-bit, a smaller value means it wrapped around */
+		if(raw_us < source->last_raw_us)
+			source->wrap_us += (uint64_t)1 << 32;
+		source->last_raw_us = raw_us;
+		record->time_us = source->wrap_us + raw_us;
+		record->direction = raw[4] & 0x01;
+		record->flags = raw[5];
+		record->data = raw[6];
+		return 1;
+	}
+
+	while(!*stop)
+	{
+		/* Return the oldest byte already read, the bytes of one read() share its time */
+		chosen = -1;
+		for(dir = 0; dir < CAPTURE_DIRECTIONS; dir++)
+		{
+			if((source->pending_index[dir] < source->pending_count[dir])
+			   && ((chosen < 0) || (source->pending_time[dir] < source->pending_time[chosen])))
+				chosen = dir;
+		}
+		if(chosen >= 0)
+		{
+			record->time_us = source->pending_time[chosen];
+			record->direction = (uint8_t)chosen;
+			record->flags = 0; /* a serial port can't report the ninth bit */
+			record->data = source->pending[chosen][source->pending_index[chosen]++];
+			return 1;
+		}
+
+		for(dir = 0; dir < CAPTURE_DIRECTIONS; dir++)
+		{
+			fds[dir].fd = source->fd[dir];
+			fds[dir].events = POLLIN;
+			fds[dir].revents = 0;
+		}
+		if(poll(fds, CAPTURE_DIRECTIONS, 100) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		now = CAPTURE_nowUs() - source->start_us;
+		for(dir = 0; dir < CAPTURE_DIRECTIONS; dir++)
+		{
+			if(!(fds[dir].revents & (POLLIN | POLLHUP)))
+				continue;
+			count = read(source->fd[dir], source->pending[dir], sizeof(source->pending[dir]));
+			if(count < 0)
+			{
+				if((errno == EAGAIN) || (errno == EINTR) || (errno == EIO))
+					continue; /* EIO: the other side of the pty is not open yet */
+				return -1;
+			}
+			source->pending_count[dir] = (uint8_t)count;
+			source->pending_index[dir] = 0;
+			source->pending_time[dir] = now;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Description :
+ * Append a record to a capture file, so a live session can be analyzed again later.
+ */
+int CAPTURE_writeRecord(FILE *file, const CAPTURE_Record *record)
+{
+	uint8_t raw[CAPTURE_RECORD_SIZE];
+	uint32_t time_us = (uint32_t)record->time_us;
+
+	raw[0] = (uint8_t)time_us;
+	raw[1] = (uint8_t)(time_us >> 8);
+	raw[2] = (uint8_t)(time_us >> 16);
+	raw[3] = (uint8_t)(time_us >> 24);
+	raw[4] = record->direction;
+	raw[5] = record->flags;
+	raw[6] = record->data;
+	raw[7] = 0;
+	return (fwrite(raw, 1, CAPTURE_RECORD_SIZE, file) == CAPTURE_RECORD_SIZE) ? 0 : -1;
+}
+
+/*
+ * Description :
+ * Close the capture file or the ports.
+ */
+void CAPTURE_close(CAPTURE_Source *source)
+{
+	int dir;
+
+	if((source->file != NULL) && (source->file != stdin))
+		fclose(source->file);
+	source->file = NULL;
+	for(dir = 0; dir < CAPTURE_DIRECTIONS; dir++)
+	{
+		if(source->fd[dir] >= 0)
+			close(source->fd[dir]);
+		source->fd[dir] = -1;
+	}
+}
+
+/*
+ * Description :
+ * Return the monotonic time in microseconds.
+ */
+static uint64_t CAPTURE_nowUs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+/*
+ * Description :
+ * Open one port in raw mode. Return the file descriptor or -1.
+ */
+static int CAPTURE_openPort(const char *path, long baud)
+{
+	struct termios settings;
+	speed_t speed;
+	int fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+
+	if(fd < 0)
+		return -1;
+	if(tcgetattr(fd, &settings) != 0)
+		return fd; /* not a terminal, a fifo for example */
+
+	cfmakeraw(&settings);
+	if(baud != 0)
+	{
+		speed = CAPTURE_speed(baud);
+		if(speed == B0)
+		{
+			fprintf(stderr, "%s: %ld baud is not supported here, set it with stty and use -B 0\n", path, baud);
+			close(fd);
+			return -1;
+		}
+		cfsetispeed(&settings, speed);
+		cfsetospeed(&settings, speed);
+	}
+	if(tcsetattr(fd, TCSANOW, &settings) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Description :
+ * Return the termios speed of a baud rate, or B0 if the system has none.
+ */
+static speed_t CAPTURE_speed(long baud)
+{
+	switch(baud)
+	{
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+#ifdef B230400
+	case 230400: return B230400;
+#endif
+#ifdef B500000
+	case 500000: return B500000;
+#endif
+#ifdef B1000000
+	case 1000000: return B1000000;
+#endif
+	default: return B0;
+	}
+}
@@ -0,0 +1,102 @@
+ /******************************************************************************
+ *
+ * Module: CAPTURE
+ *
+ * File Name: capture.h
+ *
+ * Description: Header file for reading the HMI <-> Control link bytes from a
+ *              capture file or from two live serial ports / ptys
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Capture file format: a sequence of 8-byte records, little endian
+ * | TIME_US (4 bytes) | DIRECTION | FLAGS | DATA | RESERVED (0) |
+ * TIME_US is a free running microseconds counter, it may wrap around.
+ */
+#define CAPTURE_RECORD_SIZE          8
+
+/* Direction of a byte on the link */
+#define CAPTURE_DIR_HMI_TO_CONTROL   0
+#define CAPTURE_DIR_CONTROL_TO_HMI   1
+#define CAPTURE_DIRECTIONS           2
+
+/* Flags of a byte */
+#define CAPTURE_FLAG_NINTH_BIT       0x01 /* address byte of the 9-bit multi-drop bus */
+#define CAPTURE_FLAG_LINE_ERROR      0x02 /* framing or parity error seen by the capture UART */
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+typedef struct{
+ uint64_t time_us;
+ uint8_t direction;
+ uint8_t flags;
+ uint8_t data;
+}CAPTURE_Record;
+
+typedef struct{
+ FILE *file; /* capture file, NULL in the live mode */
+ int fd[CAPTURE_DIRECTIONS]; /* live mode, the port receiving each direction */
+ uint64_t start_us; /* live mode, time of CAPTURE_openPorts */
+ uint32_t last_raw_us; /* file mode, to unwrap the 32-bit time */
+ uint64_t wrap_us;
+ uint8_t pending[CAPTURE_DIRECTIONS][64]; /* live mode, bytes read but not returned yet */
+ uint8_t pending_count[CAPTURE_DIRECTIONS];
+ uint8_t pending_index[CAPTURE_DIRECTIONS];
+ uint64_t pending_time[CAPTURE_DIRECTIONS];
+}CAPTURE_Source;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Open a capture file, "-" is the standard input. Return 0 on success.
+ */
+int CAPTURE_openFile(CAPTURE_Source *source, const char *path);
+
+/*
+ * Description :
+ * Open the two ports that receive each direction of the link (a tap on the TX line of
+ * each ECU, or the ptys of the simulator) and set them to raw mode at the given baud rate,
+ * baud 0 keeps the port settings (a pty). Return 0 on success.
+ */
+int CAPTURE_openPorts(CAPTURE_Source *source, const char *hmi_tx_port,
+					  const char *control_tx_port, long baud);
+
+/*
+ * Description :
+ * Get the next byte in time order.
+ * Return 1 if a record is read, 0 at the end of the capture and -1 on a read error.
+ * In the live mode it waits for the next byte until *stop is set.
+ */
+int CAPTURE_next(CAPTURE_Source *source, CAPTURE_Record *record, volatile int *stop);
+
+/*
+ * Description :
+ * Append a record to a capture file, so a live session can be analyzed again later.
+ */
+int CAPTURE_writeRecord(FILE *file, const CAPTURE_Record *record);
+
+/*
+ * Description :
+ * Close the capture file or the ports.
+ */
+void CAPTURE_close(CAPTURE_Source *source);
+
+#endif /* CAPTURE_H_ */
@@ -0,0 +1,377 @@
+/******************************************************************************
+ *
+ * Module: DECODE
+ *
+ * File Name: decode.c
+ *
+ * Description: Source file for decoding the captured link bytes into messages,
+ *              the legacy protocol (opcodes and '#'-terminated strings) and
+ *              the framed protocol of link.c
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "decode.h"
+#include <string.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Frame types of link.c (0x01 - 0x0F) and of the applications (0x14 - 0x22) */
+static const struct{
+	uint8_t type;
+	const char *name;
+}g_frameTypes[] = {
+	{0x01, "BAUD_RESET"}, {0x02, "BAUD_PROPOSE"}, {0x03, "BAUD_ACCEPT"}, {0x04, "TEST"},
+	{0x05, "TEST_ECHO"}, {0x06, "BAUD_CONFIRM"}, {0x07, "BAUD_CONFIRMED"}, {0x08, "STATS_REQUEST"},
+	{0x09, "STATS_REPLY"}, {0x0A, "HEARTBEAT"}, {0x14, "SET_PASS"}, {0x15, "AUTH_AND_OPEN"},
+	{0x16, "AUTH_AND_CHANGE"}, {0x17, "GET_STATUS"},
+	{0x19, "CHANGE_WITH_TOKEN"}, {0x1A, "AUDIT_DUMP"},
+	{0x1B, "USER_ADD"}, {0x1C, "USER_SET"}, {0x20, "RESULT"}, {0x21, "DOOR_EVENT"}, {0x22, "EVENT_ACK"}
+};
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Decode one byte of the legacy protocol.
+ */
+static void DECODE_feedLegacy(DECODE_Decoder *decoder, const CAPTURE_Record *record);
+
+/*
+ * Description :
+ * Decode one byte of the framed protocol, the same resynchronization as link.c.
+ */
+static void DECODE_feedFramed(DECODE_Decoder *decoder, const CAPTURE_Record *record);
+
+/*
+ * Description :
+ * Search the buffer of one direction for a complete valid frame.
+ */
+static void DECODE_parseFrames(DECODE_Decoder *decoder, uint8_t dir);
+
+/*
+ * Description :
+ * Drop the first n bytes of the buffer of one direction.
+ */
+static void DECODE_dropBytes(DECODE_Decoder *decoder, uint8_t dir, uint8_t n);
+
+/*
+ * Description :
+ * Count a message and pass it to the callback.
+ */
+static void DECODE_emit(DECODE_Decoder *decoder, DECODE_Message *message);
+
+/*
+ * Description :
+ * Callback of DECODE_detect, count the valid frames.
+ */
+static void DECODE_countFrame(const DECODE_Message *message, void *context);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Reset the decoder, every decoded message is passed to callback.
+ * DECODE_AUTO must be resolved by the caller before (see DECODE_detect).
+ */
+void DECODE_init(DECODE_Decoder *decoder, DECODE_Protocol protocol,
+				 DECODE_Callback callback, void *context)
+{
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->protocol = (protocol == DECODE_AUTO) ? DECODE_FRAMED : protocol;
+	decoder->callback = callback;
+	decoder->context = context;
+}
+
+/*
+ * Description :
+ * Decode one captured byte.
+ */
+void DECODE_feed(DECODE_Decoder *decoder, const CAPTURE_Record *record)
+{
+	DECODE_Stats *stats = &decoder->stats[record->direction];
+
+	if(stats->bytes == 0)
+		stats->first_us = record->time_us;
+	stats->last_us = record->time_us;
+	stats->bytes++;
+	if(record->flags & CAPTURE_FLAG_LINE_ERROR)
+		stats->line_errors++;
+	if(record->flags & CAPTURE_FLAG_NINTH_BIT)
+	{
+		/* The address byte only selects the receiver, the frame repeats the destination */
+		stats->address_bytes++;
+		return;
+	}
+
+	if(decoder->protocol == DECODE_LEGACY)
+		DECODE_feedLegacy(decoder, record);
+	else
+		DECODE_feedFramed(decoder, record);
+}
+
+/*
+ * Description :
+ * Flush the bytes of an incomplete message at the end of the capture.
+ */
+void DECODE_finish(DECODE_Decoder *decoder)
+{
+	uint8_t dir;
+
+	for(dir = 0; dir < CAPTURE_DIRECTIONS; dir++)
+	{
+		decoder->stats[dir].noise_bytes += decoder->count[dir];
+		decoder->count[dir] = 0;
+	}
+}
+
+/*
+ * Description :
+ * Return DECODE_FRAMED if the bytes contain a valid frame, DECODE_LEGACY otherwise.
+ */
+DECODE_Protocol DECODE_detect(const CAPTURE_Record records[], size_t count)
+{
+	DECODE_Decoder decoder;
+	unsigned long frames = 0;
+	size_t i;
+
+	DECODE_init(&decoder, DECODE_FRAMED, DECODE_countFrame, &frames);
+	for(i = 0; (i < count) && (frames == 0); i++)
+	{
+		DECODE_feed(&decoder, &records[i]);
+	}
+	return (frames != 0) ? DECODE_FRAMED : DECODE_LEGACY;
+}
+
+/*
+ * Description :
+ * Return a printable name of the type of a message.
+ */
+const char *DECODE_typeName(const DECODE_Message *message)
+{
+	size_t i;
+
+	switch(message->kind)
+	{
+	case DECODE_MSG_OPCODE:
+		switch(message->type)
+		{
+		case DECODE_LEGACY_CHECK_PASS: return "CHECK_PASS";
+		case DECODE_LEGACY_INCORRECT_PASS: return "INCORRECT_PASS";
+		case DECODE_LEGACY_OPEN_DOOR: return "OPEN_DOOR";
+		default: return "CHANGE_PASS";
+		}
+	case DECODE_MSG_STRING:
+		return "PASS_STRING";
+	case DECODE_MSG_RESULT:
+		return (message->type == 'S') ? "RESULT_S" : "RESULT_F";
+	case DECODE_MSG_FRAME:
+		for(i = 0; i < sizeof(g_frameTypes) / sizeof(g_frameTypes[0]); i++)
+		{
+			if(g_frameTypes[i].type == message->type)
+				return g_frameTypes[i].name;
+		}
+		return "FRAME";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+/*
+ * Description :
+ * CRC-8 (polynomial 0x07, initial value 0x00) as computed by crc.c on the ECUs.
+ */
+uint8_t DECODE_crc8(const uint8_t *data, size_t length)
+{
+	uint8_t crc = 0x00, bit;
+	size_t i;
+
+	for(i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for(bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+/*
+ * Description :
+ * Decode one byte of the legacy protocol.
+ */
+static void DECODE_feedLegacy(DECODE_Decoder *decoder, const CAPTURE_Record *record)
+{
+	DECODE_Message message;
+	uint8_t dir = record->direction;
+	uint8_t data = record->data;
+
+	memset(&message, 0, sizeof(message));
+	message.direction = dir;
+	message.start_us = record->time_us;
+	message.end_us = record->time_us;
+	message.type = data;
+
+	if(dir == CAPTURE_DIR_CONTROL_TO_HMI)
+	{
+		message.kind = ((data == 'S') || (data == 'F')) ? DECODE_MSG_RESULT : DECODE_MSG_UNKNOWN;
+		DECODE_emit(decoder, &message);
+		return;
+	}
+
+	/* An opcode never comes in the middle of a password */
+	if((decoder->count[dir] == 0) && (data >= DECODE_LEGACY_CHECK_PASS) && (data <= DECODE_LEGACY_CHANGE_PASS))
+	{
+		message.kind = DECODE_MSG_OPCODE;
+		DECODE_emit(decoder, &message);
+		return;
+	}
+	if(data == DECODE_LEGACY_STRING_END)
+	{
+		message.kind = DECODE_MSG_STRING;
+		message.length = decoder->count[dir];
+		memcpy(message.payload, decoder->raw[dir], message.length);
+		if(message.length != 0)
+			message.start_us = decoder->raw_time[dir][0];
+		decoder->count[dir] = 0;
+		DECODE_emit(decoder, &message);
+		return;
+	}
+	if((data >= '0') && (data <= '9') && (decoder->count[dir] < DECODE_LEGACY_MAX_STRING))
+	{
+		decoder->raw[dir][decoder->count[dir]] = data;
+		decoder->raw_time[dir][decoder->count[dir]] = record->time_us;
+		decoder->count[dir]++;
+		return;
+	}
+
+	/* Anything else breaks the string in progress */
+	decoder->stats[dir].noise_bytes += decoder->count[dir];
+	decoder->count[dir] = 0;
+	message.kind = DECODE_MSG_UNKNOWN;
+	DECODE_emit(decoder, &message);
+}
+
+/*
+ * Description :
+ * Decode one byte of the framed protocol, the same resynchronization as link.c.
+ */
+static void DECODE_feedFramed(DECODE_Decoder *decoder, const CAPTURE_Record *record)
+{
+	uint8_t dir = record->direction;
+
+	/* Bytes before the SYNC are noise */
+	if((decoder->count[dir] == 0) && (record->data != DECODE_SYNC_BYTE))
+	{
+		decoder->stats[dir].noise_bytes++;
+		return;
+	}
+	decoder->raw[dir][decoder->count[dir]] = record->data;
+	decoder->raw_time[dir][decoder->count[dir]] = record->time_us;
+	decoder->count[dir]++;
+	DECODE_parseFrames(decoder, dir);
+}
+
+/*
+ * Description :
+ * Search the buffer of one direction for a complete valid frame.
+ */
+static void DECODE_parseFrames(DECODE_Decoder *decoder, uint8_t dir)
+{
+	DECODE_Message message;
+	uint8_t *raw = decoder->raw[dir];
+	uint8_t length;
+
+	while(decoder->count[dir] != 0)
+	{
+		if(raw[0] != DECODE_SYNC_BYTE)
+		{
+			decoder->stats[dir].noise_bytes++;
+			DECODE_dropBytes(decoder, dir, 1);
+			continue;
+		}
+		if(decoder->count[dir] < DECODE_HEADER_SIZE)
+			return;
+		length = raw[4];
+		if(length > DECODE_MAX_PAYLOAD)
+		{
+			decoder->stats[dir].length_errors++;
+			decoder->stats[dir].noise_bytes++;
+			DECODE_dropBytes(decoder, dir, 1);
+			continue;
+		}
+		if(decoder->count[dir] < length + DECODE_OVERHEAD)
+			return;
+		if(DECODE_crc8(&raw[1], length + DECODE_HEADER_SIZE - 1) != raw[length + DECODE_HEADER_SIZE])
+		{
+			decoder->stats[dir].crc_errors++;
+			decoder->stats[dir].noise_bytes++;
+			DECODE_dropBytes(decoder, dir, 1);
+			continue;
+		}
+
+		memset(&message, 0, sizeof(message));
+		message.kind = DECODE_MSG_FRAME;
+		message.direction = dir;
+		message.start_us = decoder->raw_time[dir][0];
+		message.end_us = decoder->raw_time[dir][length + DECODE_HEADER_SIZE];
+		message.destination = raw[1];
+		message.source = raw[2];
+		message.type = raw[3];
+		message.length = length;
+		memcpy(message.payload, &raw[DECODE_HEADER_SIZE], length);
+		DECODE_dropBytes(decoder, dir, length + DECODE_OVERHEAD);
+		DECODE_emit(decoder, &message);
+	}
+}
+
+/*
+ * Description :
+ * Drop the first n bytes of the buffer of one direction.
+ */
+static void DECODE_dropBytes(DECODE_Decoder *decoder, uint8_t dir, uint8_t n)
+{
+	uint8_t i;
+
+	for(i = n; i < decoder->count[dir]; i++)
+	{
+		decoder->raw[dir][i - n] = decoder->raw[dir][i];
+		decoder->raw_time[dir][i - n] = decoder->raw_time[dir][i];
+	}
+	decoder->count[dir] -= n;
+}
+
+/*
+ * Description :
+ * Count a message and pass it to the callback.
+ */
+static void DECODE_emit(DECODE_Decoder *decoder, DECODE_Message *message)
+{
+	DECODE_Stats *stats = &decoder->stats[message->direction];
+
+	if(message->kind == DECODE_MSG_UNKNOWN)
+		stats->noise_bytes++;
+	else
+		stats->messages++;
+	stats->payload_bytes += message->length;
+	if(decoder->callback != NULL)
+		decoder->callback(message, decoder->context);
+}
+
+/*
+ * Description :
+ * Callback of DECODE_detect, count the valid frames.
+ */
+static void DECODE_countFrame(const DECODE_Message *message, void *context)
+{
+	(void)message;
+	(*(unsigned long *)context)++;
+}
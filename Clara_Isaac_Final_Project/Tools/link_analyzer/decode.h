@@ -0,0 +1,136 @@
+ /******************************************************************************
+ *
+ * Module: DECODE
+ *
+ * File Name: decode.h
+ *
+ * Description: Header file for decoding the captured link bytes into messages,
+ *              the legacy protocol (opcodes and '#'-terminated strings) and
+ *              the framed protocol of link.c
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef DECODE_H_
+#define DECODE_H_
+
+#include "capture.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Legacy protocol: opcodes sent by the HMI ECU, passwords as "12345#", results 'S' / 'F' */
+#define DECODE_LEGACY_CHECK_PASS      0x10
+#define DECODE_LEGACY_INCORRECT_PASS  0x11
+#define DECODE_LEGACY_OPEN_DOOR       0x12
+#define DECODE_LEGACY_CHANGE_PASS     0x13
+#define DECODE_LEGACY_STRING_END      '#'
+#define DECODE_LEGACY_MAX_STRING      16
+
+/* Framed protocol: | SYNC | DESTINATION | SOURCE | TYPE | LENGTH | PAYLOAD | CRC-8 | */
+#define DECODE_SYNC_BYTE              0x7E
+#define DECODE_MAX_PAYLOAD            16
+#define DECODE_HEADER_SIZE            5
+#define DECODE_OVERHEAD               6
+#define DECODE_BROADCAST_ADDRESS      0xFF
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+typedef enum{
+	DECODE_AUTO, DECODE_LEGACY, DECODE_FRAMED
+}DECODE_Protocol;
+
+typedef enum{
+	DECODE_MSG_OPCODE, /* legacy opcode byte */
+	DECODE_MSG_STRING, /* legacy '#'-terminated string */
+	DECODE_MSG_RESULT, /* legacy 'S' / 'F' */
+	DECODE_MSG_UNKNOWN, /* legacy byte that fits nothing */
+	DECODE_MSG_FRAME /* valid frame */
+}DECODE_Kind;
+
+typedef struct{
+ DECODE_Kind kind;
+ uint8_t direction;
+ uint64_t start_us; /* first byte */
+ uint64_t end_us; /* last byte */
+ uint8_t type; /* opcode, result or frame type */
+ uint8_t destination;
+ uint8_t source;
+ uint8_t length;
+ uint8_t payload[DECODE_MAX_PAYLOAD];
+}DECODE_Message;
+
+/* Error and traffic counters of one direction */
+typedef struct{
+ uint64_t bytes;
+ uint64_t address_bytes; /* ninth bit set */
+ uint64_t line_errors; /* flagged by the capture UART */
+ uint64_t messages;
+ uint64_t payload_bytes;
+ uint64_t noise_bytes; /* bytes outside any frame */
+ uint64_t crc_errors; /* candidate frames with a wrong CRC */
+ uint64_t length_errors; /* candidate frames with a too long LENGTH */
+ uint64_t first_us;
+ uint64_t last_us;
+}DECODE_Stats;
+
+typedef void (*DECODE_Callback)(const DECODE_Message *message, void *context);
+
+typedef struct{
+ DECODE_Protocol protocol;
+ DECODE_Callback callback;
+ void *context;
+ DECODE_Stats stats[CAPTURE_DIRECTIONS];
+ /* receive buffer of each direction, kept between bytes like g_rxRaw in link.c */
+ uint8_t raw[CAPTURE_DIRECTIONS][DECODE_MAX_PAYLOAD + DECODE_OVERHEAD];
+ uint64_t raw_time[CAPTURE_DIRECTIONS][DECODE_MAX_PAYLOAD + DECODE_OVERHEAD];
+ uint8_t count[CAPTURE_DIRECTIONS];
+}DECODE_Decoder;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Reset the decoder, every decoded message is passed to callback.
+ * DECODE_AUTO must be resolved by the caller before (see DECODE_detect).
+ */
+void DECODE_init(DECODE_Decoder *decoder, DECODE_Protocol protocol,
+				 DECODE_Callback callback, void *context);
+
+/*
+ * Description :
+ * Decode one captured byte.
+ */
+void DECODE_feed(DECODE_Decoder *decoder, const CAPTURE_Record *record);
+
+/*
+ * Description :
+ * Flush the bytes of an incomplete message at the end of the capture.
+ */
+void DECODE_finish(DECODE_Decoder *decoder);
+
+/*
+ * Description :
+ * Return DECODE_FRAMED if the bytes contain a valid frame, DECODE_LEGACY otherwise.
+ */
+DECODE_Protocol DECODE_detect(const CAPTURE_Record records[], size_t count);
+
+/*
+ * Description :
+ * Return a printable name of the type of a message.
+ */
+const char *DECODE_typeName(const DECODE_Message *message);
+
+/*
+ * Description :
+ * CRC-8 (polynomial 0x07, initial value 0x00) as computed by crc.c on the ECUs.
+ */
+uint8_t DECODE_crc8(const uint8_t *data, size_t length);
+
+#endif /* DECODE_H_ */
@@ -0,0 +1,252 @@
+/******************************************************************************
+ *
+ * File Name: main.c
+ *
+ * Description: Host tool that analyzes a capture of the HMI <-> Control UART link,
+ *              it prints the per-transaction round-trip latency, the throughput
+ *              and the error counters as text and CSV.
+ *
+ * Usage:
+ *   link_analyzer [options] -f capture.bin       analyze a capture file ("-" = stdin)
+ *   link_analyzer [options] -i hmi_tx -o ctrl_tx capture live from 2 ports / ptys, Ctrl+C ends
+ *
+ * Options:
+ *   -p auto|legacy|framed  protocol, auto detects frames in a file (live: framed)
+ *   -B baud                line rate for the ports and the load column (default 9600, 0 = keep)
+ *   -t ms                  reply timeout of the framed protocol (default 50, LINK_REPLY_TIMEOUT_MS)
+ *   -v                     print every decoded message
+ *   -c file.csv            one CSV row per transaction
+ *   -C file.csv            the report as CSV
+ *   -w capture.bin         save the live capture in the capture file format (capture.h)
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "capture.h"
+#include "decode.h"
+#include "report.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static volatile int g_stop = 0;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+static void APP_onSignal(int signal_number); /* end the live capture */
+static void APP_usage(const char *name); /* print the options */
+static FILE *APP_openOutput(const char *path); /* open an output file, "-" is stdout */
+static CAPTURE_Record *APP_readAll(CAPTURE_Source *source, size_t *count); /* load a whole capture file */
+
+int main(int argc, char *argv[])
+{
+	/* Variables Declaration */
+	const char *capture_path = NULL, *hmi_port = NULL, *control_port = NULL;
+	const char *csv_path = NULL, *report_csv_path = NULL, *save_path = NULL;
+	DECODE_Protocol protocol = DECODE_AUTO;
+	unsigned long timeout_ms = 50;
+	long baud = 9600;
+	int verbose = 0, option, result;
+	FILE *csv = NULL, *report_csv = NULL, *save = NULL;
+	CAPTURE_Source source;
+	CAPTURE_Record record, *records = NULL;
+	size_t count = 0, i;
+	static DECODE_Decoder decoder;
+	static REPORT_Context report;
+
+	while((option = getopt(argc, argv, "f:i:o:p:B:t:vc:C:w:h")) != -1)
+	{
+		switch(option)
+		{
+		case 'f': capture_path = optarg; break;
+		case 'i': hmi_port = optarg; break;
+		case 'o': control_port = optarg; break;
+		case 'p':
+			if(strcmp(optarg, "legacy") == 0)
+				protocol = DECODE_LEGACY;
+			else if(strcmp(optarg, "framed") == 0)
+				protocol = DECODE_FRAMED;
+			else if(strcmp(optarg, "auto") == 0)
+				protocol = DECODE_AUTO;
+			else
+			{
+				APP_usage(argv[0]);
+				return 2;
+			}
+			break;
+		case 'B': baud = strtol(optarg, NULL, 10); break;
+		case 't': timeout_ms = strtoul(optarg, NULL, 10); break;
+		case 'v': verbose = 1; break;
+		case 'c': csv_path = optarg; break;
+		case 'C': report_csv_path = optarg; break;
+		case 'w': save_path = optarg; break;
+		default:
+			APP_usage(argv[0]);
+			return (option == 'h') ? 0 : 2;
+		}
+	}
+	if((capture_path == NULL) == ((hmi_port == NULL) || (control_port == NULL)))
+	{
+		APP_usage(argv[0]);
+		return 2;
+	}
+
+	if(((csv_path != NULL) && ((csv = APP_openOutput(csv_path)) == NULL)) ||
+	   ((report_csv_path != NULL) && ((report_csv = APP_openOutput(report_csv_path)) == NULL)) ||
+	   ((save_path != NULL) && ((save = fopen(save_path, "wb")) == NULL)))
+	{
+		perror("output");
+		return 1;
+	}
+
+	if(capture_path != NULL)
+	{
+		if(CAPTURE_openFile(&source, capture_path) != 0)
+		{
+			perror(capture_path);
+			return 1;
+		}
+		/* The file is read twice in the auto mode, the protocol is known before the first message */
+		records = APP_readAll(&source, &count);
+		CAPTURE_close(&source);
+		if(records == NULL)
+		{
+			fprintf(stderr, "%s: read error\n", capture_path);
+			return 1;
+		}
+		if(protocol == DECODE_AUTO)
+			protocol = DECODE_detect(records, count);
+	}
+	else
+	{
+		if(CAPTURE_openPorts(&source, hmi_port, control_port, baud) != 0)
+		{
+			perror("ports");
+			return 1;
+		}
+		if(protocol == DECODE_AUTO)
+			protocol = DECODE_FRAMED;
+		signal(SIGINT, APP_onSignal);
+		signal(SIGTERM, APP_onSignal);
+	}
+
+	REPORT_init(&report, protocol, timeout_ms, verbose ? stdout : NULL, csv);
+	DECODE_init(&decoder, protocol, REPORT_onMessage, &report);
+	if(records != NULL)
+	{
+		for(i = 0; i < count; i++)
+		{
+			DECODE_feed(&decoder, &records[i]);
+		}
+		free(records);
+	}
+	else
+	{
+		while((result = CAPTURE_next(&source, &record, &g_stop)) == 1)
+		{
+			if(save != NULL)
+				CAPTURE_writeRecord(save, &record);
+			DECODE_feed(&decoder, &record);
+		}
+		CAPTURE_close(&source);
+		if(result < 0)
+			perror("capture");
+	}
+	DECODE_finish(&decoder);
+	REPORT_finish(&report);
+
+	if(verbose)
+		printf("\n");
+	REPORT_printText(&report, &decoder, stdout, baud);
+	if(report_csv != NULL)
+		REPORT_printCsv(&report, &decoder, report_csv);
+
+	if((csv != NULL) && (csv != stdout))
+		fclose(csv);
+	if((report_csv != NULL) && (report_csv != stdout))
+		fclose(report_csv);
+	if(save != NULL)
+		fclose(save);
+	return 0;
+}
+
+/*
+ * Description:
+ * End the live capture, the report is printed on the way out.
+ */
+static void APP_onSignal(int signal_number)
+{
+	(void)signal_number;
+	g_stop = 1;
+}
+
+/*
+ * Description:
+ * Print the options.
+ */
+static void APP_usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s [options] -f capture.bin\n"
+			"       %s [options] -i hmi_tx_port -o control_tx_port\n"
+			"  -p auto|legacy|framed  protocol (default auto, live captures use framed)\n"
+			"  -B baud                line rate (default 9600, 0 keeps the port settings)\n"
+			"  -t ms                  reply timeout of the framed protocol (default 50)\n"
+			"  -v                     print every decoded message\n"
+			"  -c file.csv            one CSV row per transaction\n"
+			"  -C file.csv            the report as CSV\n"
+			"  -w capture.bin         save the live capture\n", name, name);
+}
+
+/*
+ * Description:
+ * Open an output file, "-" is stdout.
+ */
+static FILE *APP_openOutput(const char *path)
+{
+	return (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+}
+
+/*
+ * Description:
+ * Load a whole capture file, return NULL on a read error.
+ */
+static CAPTURE_Record *APP_readAll(CAPTURE_Source *source, size_t *count)
+{
+	CAPTURE_Record *records = NULL, *bigger;
+	size_t size = 0;
+	int result;
+
+	*count = 0;
+	while(1)
+	{
+		if(*count == size)
+		{
+			size = (size == 0) ? 4096 : 2 * size;
+			bigger = realloc(records, size * sizeof(*records));
+			if(bigger == NULL)
+			{
+				free(records);
+				return NULL;
+			}
+			records = bigger;
+		}
+		result = CAPTURE_next(source, &records[*count], &g_stop);
+		if(result == 0)
+			return records;
+		if(result < 0)
+		{
+			free(records);
+			return NULL;
+		}
+		(*count)++;
+	}
+}
@@ -0,0 +1,533 @@
+/******************************************************************************
+ *
+ * Module: REPORT
+ *
+ * File Name: report.c
+ *
+ * Description: Source file for matching the decoded messages into request/reply
+ *              transactions and printing the latency, throughput and error reports
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#include "report.h"
+#include <string.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+#define REPORT_NO_REPLY        0x00
+
+/* Frame types that are answered, see link.h, control_ecu.c and hmi_ecu.c */
+#define REPORT_RESULT          0x20
+#define REPORT_DOOR_EVENT      0x21
+#define REPORT_EVENT_ACK       0x22
+#define REPORT_HEARTBEAT       0x0A
+#define REPORT_HMI_ADDRESS     0x00
+
+/*******************************************************************************
+ *                      Functions Prototypes(Private)                          *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Return the frame type that answers a request type, REPORT_NO_REPLY if it is not answered.
+ */
+static uint8_t REPORT_replyType(uint8_t request_type);
+
+/*
+ * Description :
+ * Return 1 if the frame answers a request.
+ */
+static int REPORT_isReply(const DECODE_Message *message);
+
+/*
+ * Description :
+ * Print one decoded message in the trace.
+ */
+static void REPORT_trace(const REPORT_Context *report, const DECODE_Message *message);
+
+/*
+ * Description :
+ * Match a frame of the framed protocol.
+ */
+static void REPORT_onFrame(REPORT_Context *report, const DECODE_Message *message);
+
+/*
+ * Description :
+ * Match a message of the legacy protocol, the HMI ECU has one request at a time.
+ */
+static void REPORT_onLegacy(REPORT_Context *report, const DECODE_Message *message);
+
+/*
+ * Description :
+ * Close the pending requests older than the timeout.
+ */
+static void REPORT_expire(REPORT_Context *report, uint64_t now_us);
+
+/*
+ * Description :
+ * Record a finished transaction, reply is NULL for a timeout.
+ */
+static void REPORT_close(REPORT_Context *report, REPORT_Pending *pending, const DECODE_Message *reply);
+
+/*
+ * Description :
+ * Return the statistics of a request type, a new line is added for a new name.
+ */
+static REPORT_TypeStats *REPORT_typeStats(REPORT_Context *report, const char *name);
+
+/*
+ * Description :
+ * Return the first and last time of the capture in both directions.
+ */
+static void REPORT_span(const DECODE_Decoder *decoder, uint64_t *first_us, uint64_t *last_us);
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Reset the report, a request without a reply within timeout_ms is a timeout (framed protocol only,
+ * the legacy Control ECU blocks until the user finishes typing).
+ */
+void REPORT_init(REPORT_Context *report, DECODE_Protocol protocol, unsigned long timeout_ms,
+				 FILE *trace, FILE *csv)
+{
+	memset(report, 0, sizeof(*report));
+	report->protocol = protocol;
+	report->timeout_us = (uint64_t)timeout_ms * 1000u;
+	report->trace = trace;
+	report->csv = csv;
+	if(csv != NULL)
+		fprintf(csv, "index,start_us,direction,node,request,reply,status,retries,rtt_us,response_us\n");
+}
+
+/*
+ * Description :
+ * DECODE_Callback, match the message with the pending requests.
+ */
+void REPORT_onMessage(const DECODE_Message *message, void *context)
+{
+	REPORT_Context *report = (REPORT_Context *)context;
+
+	report->last_us = message->end_us;
+	REPORT_trace(report, message);
+	if(report->protocol == DECODE_LEGACY)
+	{
+		REPORT_onLegacy(report, message);
+		return;
+	}
+	REPORT_expire(report, message->start_us);
+	if(message->kind == DECODE_MSG_FRAME)
+		REPORT_onFrame(report, message);
+}
+
+/*
+ * Description :
+ * Close the requests still waiting for their reply at the end of the capture.
+ */
+void REPORT_finish(REPORT_Context *report)
+{
+	uint8_t i;
+
+	for(i = 0; i < REPORT_MAX_PENDING; i++)
+	{
+		if(report->pending[i].used)
+			REPORT_close(report, &report->pending[i], NULL);
+	}
+}
+
+/*
+ * Description :
+ * Print the throughput, error and latency report as text,
+ * baud 0 skips the line utilization.
+ */
+void REPORT_printText(const REPORT_Context *report, const DECODE_Decoder *decoder, FILE *out, long baud)
+{
+	static const char *const directions[CAPTURE_DIRECTIONS] = {"HMI->Control", "Control->HMI"};
+	const DECODE_Stats *stats;
+	const REPORT_TypeStats *type;
+	uint64_t first_us, last_us, ok = 0, timeouts = 0, retries = 0;
+	double seconds;
+	/* start + data + stop bits, the framed protocol runs in the 9-bit mode */
+	unsigned bits_per_byte = (report->protocol == DECODE_FRAMED) ? 11 : 10;
+	uint8_t dir, i;
+
+	REPORT_span(decoder, &first_us, &last_us);
+	seconds = (last_us > first_us) ? (double)(last_us - first_us) / 1e6 : 0.0;
+
+	fprintf(out, "Protocol: %s, capture length %.3f s\n\n",
+			(report->protocol == DECODE_FRAMED) ? "framed" : "legacy", seconds);
+	fprintf(out, "%-13s %9s %7s %8s %8s %7s %6s %6s %6s %10s %6s\n", "direction", "bytes", "address",
+			"messages", "payload", "noise", "crc", "length", "line", "bytes/s", "load%");
+	for(dir = 0; dir < CAPTURE_DIRECTIONS; dir++)
+	{
+		stats = &decoder->stats[dir];
+		fprintf(out, "%-13s %9llu %7llu %8llu %8llu %7llu %6llu %6llu %6llu %10.1f ", directions[dir],
+				(unsigned long long)stats->bytes, (unsigned long long)stats->address_bytes,
+				(unsigned long long)stats->messages, (unsigned long long)stats->payload_bytes,
+				(unsigned long long)stats->noise_bytes, (unsigned long long)stats->crc_errors,
+				(unsigned long long)stats->length_errors, (unsigned long long)stats->line_errors,
+				(seconds > 0.0) ? (double)stats->bytes / seconds : 0.0);
+		if((baud > 0) && (seconds > 0.0))
+			fprintf(out, "%6.1f\n", 100.0 * (double)stats->bytes * bits_per_byte / (seconds * (double)baud));
+		else
+			fprintf(out, "%6s\n", "-");
+	}
+
+	for(i = 0; i < report->types_num; i++)
+	{
+		ok += report->types[i].ok;
+		timeouts += report->types[i].timeouts;
+		retries += report->types[i].retries;
+	}
+	fprintf(out, "\nTransactions: %llu, answered %llu, timeouts %llu, retries %llu, unsolicited replies %llu\n\n",
+			(unsigned long long)report->transactions, (unsigned long long)ok, (unsigned long long)timeouts,
+			(unsigned long long)retries, (unsigned long long)report->unsolicited);
+	fprintf(out, "%-18s %7s %7s %8s %7s %10s %10s %10s %12s\n", "request", "count", "ok", "timeout",
+			"retries", "rtt_min_us", "rtt_avg_us", "rtt_max_us", "response_us");
+	for(i = 0; i < report->types_num; i++)
+	{
+		type = &report->types[i];
+		fprintf(out, "%-18s %7llu %7llu %8llu %7llu ", type->name, (unsigned long long)type->count,
+				(unsigned long long)type->ok, (unsigned long long)type->timeouts,
+				(unsigned long long)type->retries);
+		if(type->ok != 0)
+			fprintf(out, "%10llu %10llu %10llu %12llu\n", (unsigned long long)type->rtt_min_us,
+					(unsigned long long)(type->rtt_sum_us / type->ok), (unsigned long long)type->rtt_max_us,
+					(unsigned long long)(type->response_sum_us / type->ok));
+		else
+			fprintf(out, "%10s %10s %10s %12s\n", "-", "-", "-", "-");
+	}
+}
+
+/*
+ * Description :
+ * Write the same report as CSV, one row per direction and one row per request type.
+ */
+void REPORT_printCsv(const REPORT_Context *report, const DECODE_Decoder *decoder, FILE *out)
+{
+	static const char *const directions[CAPTURE_DIRECTIONS] = {"hmi_to_control", "control_to_hmi"};
+	const DECODE_Stats *stats;
+	const REPORT_TypeStats *type;
+	uint64_t first_us, last_us;
+	double seconds;
+	uint8_t dir, i;
+
+	REPORT_span(decoder, &first_us, &last_us);
+	seconds = (last_us > first_us) ? (double)(last_us - first_us) / 1e6 : 0.0;
+
+	fprintf(out, "scope,name,bytes,address_bytes,messages,payload_bytes,noise_bytes,crc_errors,"
+				 "length_errors,line_errors,bytes_per_s,count,ok,timeouts,retries,"
+				 "rtt_min_us,rtt_avg_us,rtt_max_us,response_avg_us\n");
+	for(dir = 0; dir < CAPTURE_DIRECTIONS; dir++)
+	{
+		stats = &decoder->stats[dir];
+		fprintf(out, "direction,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.1f,,,,,,,,\n", directions[dir],
+				(unsigned long long)stats->bytes, (unsigned long long)stats->address_bytes,
+				(unsigned long long)stats->messages, (unsigned long long)stats->payload_bytes,
+				(unsigned long long)stats->noise_bytes, (unsigned long long)stats->crc_errors,
+				(unsigned long long)stats->length_errors, (unsigned long long)stats->line_errors,
+				(seconds > 0.0) ? (double)stats->bytes / seconds : 0.0);
+	}
+	for(i = 0; i < report->types_num; i++)
+	{
+		type = &report->types[i];
+		fprintf(out, "request,%s,,,,,,,,,,%llu,%llu,%llu,%llu,", type->name, (unsigned long long)type->count,
+				(unsigned long long)type->ok, (unsigned long long)type->timeouts,
+				(unsigned long long)type->retries);
+		if(type->ok != 0)
+			fprintf(out, "%llu,%llu,%llu,%llu\n", (unsigned long long)type->rtt_min_us,
+					(unsigned long long)(type->rtt_sum_us / type->ok), (unsigned long long)type->rtt_max_us,
+					(unsigned long long)(type->response_sum_us / type->ok));
+		else
+			fprintf(out, ",,,\n");
+	}
+}
+
+/*
+ * Description :
+ * Return the frame type that answers a request type, REPORT_NO_REPLY if it is not answered.
+ */
+static uint8_t REPORT_replyType(uint8_t request_type)
+{
+	switch(request_type)
+	{
+	case 0x02: return 0x03; /* BAUD_PROPOSE -> BAUD_ACCEPT */
+	case 0x04: return 0x05; /* TEST -> TEST_ECHO */
+	case 0x06: return 0x07; /* BAUD_CONFIRM -> BAUD_CONFIRMED */
+	case 0x08: return 0x09; /* STATS_REQUEST -> STATS_REPLY */
+	case REPORT_HEARTBEAT: return REPORT_HEARTBEAT; /* the addressed one is echoed */
+	case REPORT_DOOR_EVENT: return REPORT_EVENT_ACK;
+	/* The requests are answered by one RESULT, 0x18 is not assigned */
+	case 0x14: /* SET_PASS */
+	case 0x15: /* AUTH_AND_OPEN */
+	case 0x16: /* AUTH_AND_CHANGE */
+	case 0x17: /* GET_STATUS */
+	case 0x19: /* CHANGE_WITH_TOKEN */
+	case 0x1A: /* AUDIT_DUMP */
+	case 0x1B: /* USER_ADD */
+	case 0x1C: /* USER_SET */
+		return REPORT_RESULT;
+	default:
+		return REPORT_NO_REPLY;
+	}
+}
+
+/*
+ * Description :
+ * Return 1 if the frame answers a request.
+ */
+static int REPORT_isReply(const DECODE_Message *message)
+{
+	switch(message->type)
+	{
+	case 0x03: case 0x05: case 0x07: case 0x09: /* link management answers */
+	case REPORT_RESULT:
+	case REPORT_EVENT_ACK:
+		return 1;
+	case REPORT_HEARTBEAT:
+		return message->destination == REPORT_HMI_ADDRESS;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Description :
+ * Print one decoded message in the trace.
+ */
+static void REPORT_trace(const REPORT_Context *report, const DECODE_Message *message)
+{
+	uint8_t i;
+
+	if(report->trace == NULL)
+		return;
+
+	fprintf(report->trace, "%12.3f ms  %s  ", (double)message->start_us / 1000.0,
+			(message->direction == CAPTURE_DIR_HMI_TO_CONTROL) ? "H>C" : "C>H");
+	if(message->kind == DECODE_MSG_FRAME)
+		fprintf(report->trace, "[%02X>%02X] ", message->source, message->destination);
+	fprintf(report->trace, "%-18s", DECODE_typeName(message));
+	if(message->kind == DECODE_MSG_UNKNOWN)
+		fprintf(report->trace, " 0x%02X", message->type);
+	for(i = 0; i < message->length; i++)
+	{
+		fprintf(report->trace, " %02X", message->payload[i]);
+	}
+	fprintf(report->trace, "\n");
+}
+
+/*
+ * Description :
+ * Match a frame of the framed protocol.
+ */
+static void REPORT_onFrame(REPORT_Context *report, const DECODE_Message *message)
+{
+	REPORT_Pending *pending, *free_slot = NULL;
+	uint8_t i, reply_type;
+
+	/* A reply goes back from the node the request was sent to */
+	for(i = 0; i < REPORT_MAX_PENDING; i++)
+	{
+		pending = &report->pending[i];
+		if(pending->used && (pending->reply_type == message->type)
+		   && (pending->request.source == message->destination)
+		   && (pending->request.destination == message->source))
+		{
+			REPORT_close(report, pending, message);
+			return;
+		}
+	}
+
+	reply_type = REPORT_replyType(message->type);
+	if((message->type == REPORT_HEARTBEAT) && (message->destination == REPORT_HMI_ADDRESS))
+		reply_type = REPORT_NO_REPLY; /* the echo of a door, not a request */
+	if((reply_type == REPORT_NO_REPLY) || (message->destination == DECODE_BROADCAST_ADDRESS))
+	{
+		/* Broadcasts and plain replies, a reply here matched nothing */
+		if(REPORT_isReply(message))
+			report->unsolicited++;
+		return;
+	}
+
+	for(i = 0; i < REPORT_MAX_PENDING; i++)
+	{
+		pending = &report->pending[i];
+		if(!pending->used)
+		{
+			if(free_slot == NULL)
+				free_slot = pending;
+			continue;
+		}
+		if((pending->request.type != message->type) || (pending->request.source != message->source)
+		   || (pending->request.destination != message->destination))
+			continue;
+		/* The same request again is a retry, another one means the first was never answered */
+		if((pending->request.length == message->length)
+		   && (memcmp(pending->request.payload, message->payload, message->length) == 0))
+		{
+			pending->retries++;
+			pending->request = *message;
+			return;
+		}
+		REPORT_close(report, pending, NULL);
+		free_slot = pending;
+		break;
+	}
+	if(free_slot == NULL)
+		return; /* more outstanding requests than a real node ever has */
+
+	memset(free_slot, 0, sizeof(*free_slot));
+	free_slot->used = 1;
+	free_slot->request = *message;
+	free_slot->first_start_us = message->start_us;
+	free_slot->reply_type = reply_type;
+	free_slot->name = DECODE_typeName(message);
+}
+
+/*
+ * Description :
+ * Match a message of the legacy protocol, the HMI ECU has one request at a time.
+ */
+static void REPORT_onLegacy(REPORT_Context *report, const DECODE_Message *message)
+{
+	REPORT_Pending *pending = &report->pending[0];
+
+	switch(message->kind)
+	{
+	case DECODE_MSG_RESULT:
+		if(pending->used)
+			REPORT_close(report, pending, message);
+		else
+			report->unsolicited++;
+		break;
+	case DECODE_MSG_OPCODE:
+		/* OPEN_DOOR and INCORRECT_PASS only announce a state, nothing answers them */
+		if((message->type == DECODE_LEGACY_OPEN_DOOR) || (message->type == DECODE_LEGACY_INCORRECT_PASS))
+			break;
+		/* fall through */
+	case DECODE_MSG_STRING:
+		if(!pending->used)
+		{
+			memset(pending, 0, sizeof(*pending));
+			pending->used = 1;
+			pending->first_start_us = message->start_us;
+			pending->name = (message->kind == DECODE_MSG_STRING) ? "SET_PASS" : DECODE_typeName(message);
+		}
+		/* The request goes on until its last string */
+		pending->request = *message;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Description :
+ * Close the pending requests older than the timeout.
+ */
+static void REPORT_expire(REPORT_Context *report, uint64_t now_us)
+{
+	uint8_t i;
+
+	for(i = 0; i < REPORT_MAX_PENDING; i++)
+	{
+		if(report->pending[i].used && (now_us > report->pending[i].request.end_us + report->timeout_us))
+			REPORT_close(report, &report->pending[i], NULL);
+	}
+}
+
+/*
+ * Description :
+ * Record a finished transaction, reply is NULL for a timeout.
+ */
+static void REPORT_close(REPORT_Context *report, REPORT_Pending *pending, const DECODE_Message *reply)
+{
+	REPORT_TypeStats *type = REPORT_typeStats(report, pending->name);
+	uint64_t rtt_us = 0, response_us = 0;
+	uint8_t node = (pending->request.direction == CAPTURE_DIR_HMI_TO_CONTROL) ?
+				   pending->request.destination : pending->request.source;
+
+	report->transactions++;
+	if(type != NULL)
+	{
+		type->count++;
+		type->retries += pending->retries;
+	}
+	if(reply != NULL)
+	{
+		rtt_us = reply->end_us - pending->first_start_us;
+		response_us = (reply->start_us > pending->request.end_us) ? reply->start_us - pending->request.end_us : 0;
+		if(type != NULL)
+		{
+			if((type->ok == 0) || (rtt_us < type->rtt_min_us))
+				type->rtt_min_us = rtt_us;
+			if(rtt_us > type->rtt_max_us)
+				type->rtt_max_us = rtt_us;
+			type->ok++;
+			type->rtt_sum_us += rtt_us;
+			type->response_sum_us += response_us;
+		}
+	}
+	else if(type != NULL)
+	{
+		type->timeouts++;
+	}
+
+	if(report->csv != NULL)
+	{
+		fprintf(report->csv, "%llu,%llu,%s,%u,%s,%s,%s,%u,", (unsigned long long)report->transactions,
+				(unsigned long long)pending->first_start_us,
+				(pending->request.direction == CAPTURE_DIR_HMI_TO_CONTROL) ? "hmi_to_control" : "control_to_hmi",
+				node, pending->name, (reply != NULL) ? DECODE_typeName(reply) : "",
+				(reply != NULL) ? "ok" : "timeout", pending->retries);
+		if(reply != NULL)
+			fprintf(report->csv, "%llu,%llu\n", (unsigned long long)rtt_us, (unsigned long long)response_us);
+		else
+			fprintf(report->csv, ",\n");
+	}
+	pending->used = 0;
+}
+
+/*
+ * Description :
+ * Return the statistics of a request type, a new line is added for a new name.
+ */
+static REPORT_TypeStats *REPORT_typeStats(REPORT_Context *report, const char *name)
+{
+	uint8_t i;
+
+	for(i = 0; i < report->types_num; i++)
+	{
+		if(strcmp(report->types[i].name, name) == 0)
+			return &report->types[i];
+	}
+	if(report->types_num == REPORT_MAX_TYPES)
+		return NULL;
+	memset(&report->types[i], 0, sizeof(report->types[i]));
+	report->types[i].name = name;
+	report->types_num++;
+	return &report->types[i];
+}
+
+/*
+ * Description :
+ * Return the first and last time of the capture in both directions.
+ */
+static void REPORT_span(const DECODE_Decoder *decoder, uint64_t *first_us, uint64_t *last_us)
+{
+	const DECODE_Stats *hmi = &decoder->stats[CAPTURE_DIR_HMI_TO_CONTROL];
+	const DECODE_Stats *control = &decoder->stats[CAPTURE_DIR_CONTROL_TO_HMI];
+
+	if(hmi->bytes == 0)
+		hmi = control;
+	if(control->bytes == 0)
+		control = hmi;
+	*first_us = (hmi->first_us < control->first_us) ? hmi->first_us : control->first_us;
+	*last_us = (hmi->last_us > control->last_us) ? hmi->last_us : control->last_us;
+}
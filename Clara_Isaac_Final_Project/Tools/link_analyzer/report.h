@@ -0,0 +1,105 @@
+ /******************************************************************************
+ *
+ * Module: REPORT
+ *
+ * File Name: report.h
+ *
+ * Description: Header file for matching the decoded messages into request/reply
+ *              transactions and printing the latency, throughput and error reports
+ *
+ * Author: Clara Isaac
+ *
+ *******************************************************************************/
+
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include "decode.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Requests waiting for their reply at the same time (one per node and type is enough) */
+#define REPORT_MAX_PENDING     32
+
+/* Request types that get their own line in the report */
+#define REPORT_MAX_TYPES       32
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+typedef struct{
+ uint8_t used;
+ DECODE_Message request;
+ uint64_t first_start_us; /* first copy, the retries are part of the latency */
+ uint8_t reply_type;
+ uint8_t retries;
+ const char *name;
+}REPORT_Pending;
+
+/* Latency and error statistics of one request type */
+typedef struct{
+ const char *name;
+ uint64_t count;
+ uint64_t ok;
+ uint64_t timeouts;
+ uint64_t retries;
+ uint64_t rtt_min_us;
+ uint64_t rtt_max_us;
+ uint64_t rtt_sum_us;
+ uint64_t response_sum_us;
+}REPORT_TypeStats;
+
+typedef struct{
+ DECODE_Protocol protocol;
+ uint64_t timeout_us;
+ FILE *trace; /* every decoded message, NULL for none */
+ FILE *csv; /* every transaction, NULL for none */
+ REPORT_Pending pending[REPORT_MAX_PENDING];
+ REPORT_TypeStats types[REPORT_MAX_TYPES];
+ uint8_t types_num;
+ uint64_t transactions;
+ uint64_t unsolicited; /* replies that match no request */
+ uint64_t last_us;
+}REPORT_Context;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Reset the report, a request without a reply within timeout_ms is a timeout (framed protocol only,
+ * the legacy Control ECU blocks until the user finishes typing).
+ */
+void REPORT_init(REPORT_Context *report, DECODE_Protocol protocol, unsigned long timeout_ms,
+				 FILE *trace, FILE *csv);
+
+/*
+ * Description :
+ * DECODE_Callback, match the message with the pending requests.
+ */
+void REPORT_onMessage(const DECODE_Message *message, void *context);
+
+/*
+ * Description :
+ * Close the requests still waiting for their reply at the end of the capture.
+ */
+void REPORT_finish(REPORT_Context *report);
+
+/*
+ * Description :
+ * Print the throughput, error and latency report as text,
+ * baud 0 skips the line utilization.
+ */
+void REPORT_printText(const REPORT_Context *report, const DECODE_Decoder *decoder, FILE *out, long baud);
+
+/*
+ * Description :
+ * Write the same report as CSV, one row per direction and one row per request type.
+ */
+void REPORT_printCsv(const REPORT_Context *report, const DECODE_Decoder *decoder, FILE *out);
+
+#endif /* REPORT_H_ */